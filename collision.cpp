@@ -0,0 +1,301 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "collision.h"
+#include "map.h"
+
+#include <algorithm>
+#include <cmath>
+
+CollisionGrid::CollisionGrid() :
+		GridWidth(0),
+		GridHeight(0),
+		SubCells(1),
+		WordsPerRow(0),
+		Stopping(false) {
+	RegionSizes.push_back(0);
+}
+
+unsigned int CollisionGrid::SolidMask(const ITileSet * tiles, unsigned int index, unsigned int resolution) {
+	// The flags tell which sides, and the centre, are solid or empty, so they
+	// give the shape, and Fill how much of it is solid: the sub-cells that
+	// are the most solid by their distance to each side are taken, until
+	// there are as many of them as Fill says.
+	uint32_t flags = tiles->SolidFlags(index);
+	float up = (flags & TileSet::BSU) ? 1 : (flags & TileSet::BEU) ? -1 : 0;
+	float down = (flags & TileSet::BSD) ? 1 : (flags & TileSet::BED) ? -1 : 0;
+	float left = (flags & TileSet::BSL) ? 1 : (flags & TileSet::BEL) ? -1 : 0;
+	float right = (flags & TileSet::BSR) ? 1 : (flags & TileSet::BER) ? -1 : 0;
+	float centre = (flags & TileSet::BS) ? 1 : (flags & TileSet::BE) ? -1 : 0;
+
+	unsigned int count = resolution * resolution;
+	std::pair<float, unsigned int> solidity[MAX_RESOLUTION * MAX_RESOLUTION];
+	for (unsigned int y = 0; y < resolution; ++y) {
+		for (unsigned int x = 0; x < resolution; ++x) {
+			float u = (x + 0.5f) / resolution;
+			float v = (y + 0.5f) / resolution;
+			float from_centre = std::max(std::abs(u - 0.5f), std::abs(v - 0.5f));
+			float value = up * (1 - v) + down * v + left * (1 - u) + right * u + centre * (1 - 2 * from_centre);
+			// Sorted from the most solid, the first sub-cells first when even
+			solidity[y * resolution + x] = std::make_pair(-value, y * resolution + x);
+		}
+	}
+	std::sort(solidity, solidity + count);
+
+	unsigned int solid = (tiles->Fill(index) * count + 50) / 100;
+	unsigned int mask = 0;
+	for (unsigned int i = 0; i < solid && i < count; ++i) {
+		mask |= 1 << solidity[i].second;
+	}
+	return mask;
+}
+
+bool CollisionGrid::Build(const Map & map, unsigned int resolution, unsigned int walk_layer) {
+	if (resolution != 1 && resolution != 2 && resolution != 4) return false;
+
+	// Walkable sub-cells of each tile, for each layer
+	LayerTiles.clear();
+	Walkable.clear();
+	unsigned int all = (1 << (resolution * resolution)) - 1;
+	for (unsigned int l = 1; map.Layers[l].Tiles != NULL; ++l) {
+		const ITileSet * tiles = map.Layers[l].Tiles;
+		LayerTiles.push_back(tiles);
+		Walkable.push_back(std::vector<unsigned int>(tiles->NumTiles(), 0));
+		if (l != walk_layer && l != walk_layer + 1) continue;
+		for (unsigned int t = 0; t < tiles->NumTiles(); ++t) {
+			unsigned int solid = SolidMask(tiles, t, resolution);
+			Walkable.back()[t] = l == walk_layer ? solid : all & ~solid;
+		}
+	}
+
+	SubCells = resolution;
+	GridWidth = map.Width * resolution;
+	GridHeight = map.Height * resolution;
+	WordsPerRow = (GridWidth + 63) / 64;
+	Bits.assign((size_t)WordsPerRow * GridHeight, 0);
+
+	FillTiles(map, 0, 0, map.Width, map.Height);
+	if (Stopping) return false;
+	Bands.assign((GridHeight + BAND_ROWS - 1) / BAND_ROWS, Band());
+	map.Pool->ParallelFor(0, Bands.size(), 1, [this](unsigned int b_begin, unsigned int b_end) {
+		for (unsigned int b = b_begin; b < b_end && !Stopping; ++b) LabelBand(b);
+	});
+	if (Stopping) return false;
+	JoinBands();
+	return true;
+}
+
+void CollisionGrid::Update(const Map & map, unsigned int x_begin, unsigned int y_begin,
+		unsigned int x_end, unsigned int y_end) {
+	x_end = std::min(x_end, map.Width);
+	y_end = std::min(y_end, map.Height);
+	if (x_begin >= x_end || y_begin >= y_end) return;
+	FillTiles(map, x_begin, y_begin, x_end, y_end);
+
+	// Only the bands with rows of sub-cells that changed
+	unsigned int band_begin = y_begin * SubCells / BAND_ROWS;
+	unsigned int band_end = (y_end * SubCells - 1) / BAND_ROWS + 1;
+	map.Pool->ParallelFor(band_begin, band_end, 1, [this](unsigned int b_begin, unsigned int b_end) {
+		for (unsigned int b = b_begin; b < b_end; ++b) LabelBand(b);
+	});
+	JoinBands();
+}
+
+void CollisionGrid::FillTiles(const Map & map, unsigned int x_begin, unsigned int y_begin,
+		unsigned int x_end, unsigned int y_end) {
+	unsigned int resolution = SubCells;
+	unsigned int all = (1 << (resolution * resolution)) - 1;
+
+	// Each row of tiles makes its own rows of sub-cells
+	map.Pool->ParallelFor(y_begin, y_end, 16, [&](unsigned int rows_begin, unsigned int rows_end) {
+		for (unsigned int y = rows_begin; y < rows_end && !Stopping; ++y) {
+			const ITileSet * owner = NULL;
+			const unsigned int * owner_walkable = NULL;
+			for (unsigned int x = x_begin; x < x_end; ++x) {
+				const TileSet::TileRuntime * runtime = map.Cell(x, y).TileRuntimeData;
+				unsigned int free = 0;
+				if (runtime) {
+					if (runtime->Owner != owner) {
+						owner = runtime->Owner;
+						owner_walkable = NULL;
+						for (unsigned int l = 0; l < LayerTiles.size(); ++l) {
+							if (owner == LayerTiles[l]) owner_walkable = &Walkable[l][0];
+						}
+					}
+					if (owner_walkable) free = owner_walkable[runtime->Index];
+				}
+
+				unsigned int blocked = all & ~free;
+				unsigned int sx = x * resolution;
+				uint64_t row_mask = ((uint64_t)1 << resolution) - 1;
+				for (unsigned int j = 0; j < resolution; ++j) {
+					uint64_t bits = (blocked >> (j * resolution)) & row_mask;
+					// Never split across words, since 64 is a multiple of the resolution
+					uint64_t & word = Bits[(size_t)(y * resolution + j) * WordsPerRow + (sx >> 6)];
+					word = (word & ~(row_mask << (sx & 63))) | (bits << (sx & 63));
+				}
+			}
+		}
+	});
+}
+
+void CollisionGrid::FindRuns(unsigned int y, std::vector<Run> & runs) const {
+	const uint64_t * row = Row(y);
+	Run run = { 0, 0 };
+	bool open = false;
+	for (unsigned int w = 0; w < WordsPerRow; ++w) {
+		uint64_t free = ~row[w];
+		if (w == WordsPerRow - 1 && (GridWidth & 63)) free &= ((uint64_t)1 << (GridWidth & 63)) - 1;
+		unsigned int bit = 0;
+		while (bit < 64) {
+			uint64_t rest = (open ? ~free : free) >> bit;
+			if (!rest) break;
+			bit += __builtin_ctzll(rest);
+			if (open) {
+				run.End = w * 64 + bit;
+				runs.push_back(run);
+			} else {
+				run.Begin = w * 64 + bit;
+			}
+			open = !open;
+		}
+	}
+	if (open) {
+		run.End = GridWidth;
+		runs.push_back(run);
+	}
+}
+
+// Union-find over the runs or the parts, where the root is always the first of the set
+static inline unsigned int FindRoot(std::vector<unsigned int> & parent, unsigned int i) {
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+static inline void Union(std::vector<unsigned int> & parent, unsigned int a, unsigned int b) {
+	a = FindRoot(parent, a);
+	b = FindRoot(parent, b);
+	if (a < b) parent[b] = a;
+	else if (b < a) parent[a] = b;
+}
+
+void CollisionGrid::LabelBand(unsigned int b) {
+	Band & band = Bands[b];
+	unsigned int y_begin = b * BAND_ROWS;
+	unsigned int y_end = std::min(y_begin + BAND_ROWS, GridHeight);
+
+	// Runs of walkable sub-cells, row after row
+	band.RowRuns.assign(1, 0);
+	band.Runs.clear();
+	for (unsigned int y = y_begin; y < y_end; ++y) {
+		FindRuns(y, band.Runs);
+		band.RowRuns.push_back(band.Runs.size());
+	}
+
+	// Joins the runs of each row with the ones that touch them in the row above
+	std::vector<unsigned int> parent(band.Runs.size());
+	for (unsigned int i = 0; i < parent.size(); ++i) parent[i] = i;
+	for (unsigned int row = 1; row < y_end - y_begin; ++row) {
+		unsigned int a = band.RowRuns[row - 1], a_end = band.RowRuns[row];
+		unsigned int c = band.RowRuns[row], c_end = band.RowRuns[row + 1];
+		while (a < a_end && c < c_end) {
+			if (band.Runs[a].Begin < band.Runs[c].End && band.Runs[c].Begin < band.Runs[a].End) Union(parent, a, c);
+			if (band.Runs[a].End < band.Runs[c].End) ++a;
+			else ++c;
+		}
+	}
+
+	// A parent always comes before its child, so it is numbered first
+	band.RunParts.resize(band.Runs.size());
+	band.PartSizes.clear();
+	for (unsigned int i = 0; i < band.Runs.size(); ++i) {
+		if (parent[i] == i) {
+			band.RunParts[i] = band.PartSizes.size();
+			band.PartSizes.push_back(0);
+		} else {
+			band.RunParts[i] = band.RunParts[parent[i]];
+		}
+		band.PartSizes[band.RunParts[i]] += band.Runs[i].End - band.Runs[i].Begin;
+	}
+}
+
+// Only the last row of each band touches the next one, so joining the parts
+// of the bands is cheap next to labelling them
+void CollisionGrid::JoinBands() {
+	FirstPart.assign(Bands.size() + 1, 0);
+	for (unsigned int b = 0; b < Bands.size(); ++b) {
+		FirstPart[b + 1] = FirstPart[b] + Bands[b].PartSizes.size();
+	}
+
+	std::vector<unsigned int> parent(FirstPart.back());
+	for (unsigned int i = 0; i < parent.size(); ++i) parent[i] = i;
+	for (unsigned int b = 1; b < Bands.size(); ++b) {
+		const Band & above = Bands[b - 1];
+		const Band & below = Bands[b];
+		unsigned int last_row = above.RowRuns.size() - 2;
+		unsigned int a = above.RowRuns[last_row], a_end = above.RowRuns[last_row + 1];
+		unsigned int c = 0, c_end = below.RowRuns[1];
+		while (a < a_end && c < c_end) {
+			if (above.Runs[a].Begin < below.Runs[c].End && below.Runs[c].Begin < above.Runs[a].End) {
+				Union(parent, FirstPart[b - 1] + above.RunParts[a], FirstPart[b] + below.RunParts[c]);
+			}
+			if (above.Runs[a].End < below.Runs[c].End) ++a;
+			else ++c;
+		}
+	}
+
+	// The first part of a region holds its first run, so the regions are
+	// numbered in the order of their first runs, row after row
+	PartRegions.resize(parent.size());
+	RegionSizes.assign(1, 0);
+	for (unsigned int b = 0; b < Bands.size(); ++b) {
+		for (unsigned int p = 0; p < Bands[b].PartSizes.size(); ++p) {
+			unsigned int i = FirstPart[b] + p;
+			if (parent[i] == i) {
+				PartRegions[i] = RegionSizes.size();
+				RegionSizes.push_back(0);
+			} else {
+				PartRegions[i] = PartRegions[parent[i]];
+			}
+			RegionSizes[PartRegions[i]] += Bands[b].PartSizes[p];
+		}
+	}
+}
+
+unsigned int CollisionGrid::Region(unsigned int x, unsigned int y) const {
+	if (x >= GridWidth || y >= GridHeight) return NO_REGION;
+	unsigned int b = y / BAND_ROWS;
+	const Band & band = Bands[b];
+	const Run * begin = band.Runs.data() + band.RowRuns[y - b * BAND_ROWS];
+	const Run * end = band.Runs.data() + band.RowRuns[y - b * BAND_ROWS + 1];
+	const Run * run = std::upper_bound(begin, end, x, [](unsigned int x, const Run & run) {
+		return x < run.Begin;
+	});
+	if (run == begin || x >= (run - 1)->End) return NO_REGION;
+	return PartRegions[FirstPart[b] + band.RunParts[run - 1 - band.Runs.data()]];
+}
@@ -0,0 +1,146 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef COLLISION_H_7A2D94E6_4F3B_11E3_A1F4_525400DA3F0D
+#define COLLISION_H_7A2D94E6_4F3B_11E3_A1F4_525400DA3F0D
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Map;
+class ITileSet;
+
+// Which parts of a finished map can be walked on, with resolution x resolution
+// sub-cells for each tile, one bit each, set where it is blocked. The solid
+// part of a tile is ground at the level of its layer, and the empty part
+// ground at the level of the layer below, so only the ground at the level of
+// the walking layer can be walked on. Walkable sub-cells that touch each other
+// horizontally or vertically are then grouped into regions: first within
+// bands of BAND_ROWS rows, whose parts are then joined across the bands, so
+// that a change to some rows only labels their bands again.
+class CollisionGrid {
+public:
+	enum {
+		MAX_RESOLUTION = 4,
+		NO_REGION = 0,
+		BAND_ROWS = 256,
+	};
+
+	CollisionGrid();
+
+	// walk_layer is an index into the layers of the map. Returns false if
+	// the resolution isn't 1, 2 or 4, or it was stopped.
+	bool Build(const Map & map, unsigned int resolution, unsigned int walk_layer);
+
+	// After the tiles in [x_begin, x_end) x [y_begin, y_end) have changed.
+	// Gives the same grid and regions as Build would.
+	void Update(const Map & map, unsigned int x_begin, unsigned int y_begin,
+		unsigned int x_end, unsigned int y_end);
+
+	// Makes Build give up as soon as it can, for when it runs in another
+	// thread that has to be stopped
+	inline void Stop() {
+		Stopping = true;
+	}
+
+	// Size in sub-cells
+	inline unsigned int Width() const {
+		return GridWidth;
+	}
+	inline unsigned int Height() const {
+		return GridHeight;
+	}
+	inline unsigned int Resolution() const {
+		return SubCells;
+	}
+
+	// Outside of the map is blocked
+	inline bool Blocked(unsigned int x, unsigned int y) const {
+		if (x >= GridWidth || y >= GridHeight) return true;
+		return (Bits[(size_t)y * WordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+	}
+
+	// Blocked bits of a row, the lowest bit of the first word being x = 0
+	inline const uint64_t * Row(unsigned int y) const {
+		return &Bits[(size_t)y * WordsPerRow];
+	}
+
+	// Region of a sub-cell, numbered from 1, or NO_REGION where it is blocked
+	unsigned int Region(unsigned int x, unsigned int y) const;
+
+	inline unsigned int NumRegions() const {
+		return RegionSizes.size() - 1;
+	}
+
+	// Sub-cells in a region
+	inline size_t RegionSize(unsigned int region) const {
+		return RegionSizes[region];
+	}
+
+private:
+	// Walkable sub-cells of a row, [Begin, End)
+	struct Run {
+		unsigned int Begin;
+		unsigned int End;
+	};
+
+	// Runs of the rows of a band, and the parts of the band they make
+	struct Band {
+		std::vector<unsigned int> RowRuns; // First run of each row, and the total at the end
+		std::vector<Run> Runs;
+		std::vector<unsigned int> RunParts;
+		std::vector<size_t> PartSizes;
+	};
+
+	// Sub-cells of a tile that are solid, bit y * resolution + x
+	static unsigned int SolidMask(const ITileSet * tiles, unsigned int index, unsigned int resolution);
+
+	void FillTiles(const Map & map, unsigned int x_begin, unsigned int y_begin,
+		unsigned int x_end, unsigned int y_end);
+
+	// Appends the runs of a row
+	void FindRuns(unsigned int y, std::vector<Run> & runs) const;
+
+	void LabelBand(unsigned int band);
+	void JoinBands();
+
+	unsigned int GridWidth;
+	unsigned int GridHeight;
+	unsigned int SubCells;
+	unsigned int WordsPerRow;
+	std::vector<uint64_t> Bits;
+	std::vector<const ITileSet *> LayerTiles;
+	std::vector< std::vector<unsigned int> > Walkable; // Sub-cells of each tile of each layer
+
+	std::vector<Band> Bands;
+	std::vector<unsigned int> FirstPart;   // Of each band, and the total at the end
+	std::vector<unsigned int> PartRegions;
+	std::vector<size_t> RegionSizes;       // Nothing for NO_REGION
+	std::atomic<bool> Stopping;
+};
+
+#endif // COLLISION_H_7A2D94E6_4F3B_11E3_A1F4_525400DA3F0D
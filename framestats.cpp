@@ -0,0 +1,90 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "framestats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+FrameStats::FrameStats() :
+		Count(0),
+		Next(0),
+		DrawCalls(0),
+		VisibleTiles(0) {
+}
+
+void FrameStats::AddFrame(float frame_ms, unsigned int draw_calls, unsigned int visible_tiles) {
+	Times[Next] = frame_ms;
+	Next = (Next + 1) % HISTORY;
+	if (Count < HISTORY) ++Count;
+	DrawCalls = draw_calls;
+	VisibleTiles = visible_tiles;
+}
+
+float FrameStats::Percentile(float fraction) const {
+	if (!Count) return 0;
+	float sorted[HISTORY];
+	std::copy(Times, Times + Count, sorted);
+	unsigned int n = fraction * (Count - 1) + 0.5f;
+	std::nth_element(sorted, sorted + n, sorted + Count);
+	return sorted[n];
+}
+
+void FrameStats::Summary(char * text, size_t size) const {
+	snprintf(text, size, "frame p50 %.1f p95 %.1f p99 %.1f ms, %u draw calls, %u tiles",
+		Percentile(0.50f), Percentile(0.95f), Percentile(0.99f), DrawCalls, VisibleTiles);
+}
+
+void FrameStats::DrawGraph(sf::RenderTarget & target, float x, float y) const {
+	// 2 pixels for each frame and for each millisecond, up to 50 ms
+	const float bar_width = 2;
+	const float scale = 2;
+	const float height = 50 * scale;
+	sf::VertexArray quads(sf::Quads);
+
+	auto add_quad = [&](float left, float top, float width, float h, const sf::Color & color) {
+		quads.append(sf::Vertex(sf::Vector2f(left, top), color));
+		quads.append(sf::Vertex(sf::Vector2f(left + width, top), color));
+		quads.append(sf::Vertex(sf::Vector2f(left + width, top + h), color));
+		quads.append(sf::Vertex(sf::Vector2f(left, top + h), color));
+	};
+
+	add_quad(x, y, HISTORY * bar_width, height, sf::Color(0, 0, 0, 160));
+
+	// Oldest frame on the left
+	unsigned int first = (Next + HISTORY - Count) % HISTORY;
+	for (unsigned int i = 0; i < Count; ++i) {
+		float ms = Times[(first + i) % HISTORY];
+		float h = std::min(ms * scale, height);
+		sf::Color color = ms <= 1000.0f / 60 ? sf::Color(0, 200, 0) :
+			ms <= 1000.0f / 30 ? sf::Color(220, 200, 0) : sf::Color(220, 0, 0);
+		add_quad(x + i * bar_width, y + height - h, bar_width, h, color);
+	}
+
+	add_quad(x, y + height - 1000.0f / 60 * scale, HISTORY * bar_width, 1, sf::Color(255, 255, 255, 128));
+	add_quad(x, y + height - 1000.0f / 30 * scale, HISTORY * bar_width, 1, sf::Color(255, 255, 255, 128));
+
+	target.draw(quads);
+}
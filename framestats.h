@@ -0,0 +1,64 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef FRAMESTATS_H_6B2D91C8_4F10_11E3_9A4E_525400DA3F0D
+#define FRAMESTATS_H_6B2D91C8_4F10_11E3_9A4E_525400DA3F0D
+
+#include <SFML/Graphics.hpp>
+
+#include <cstddef>
+
+// Times of the last frames drawn, with how much was drawn in the last one
+class FrameStats {
+public:
+	enum { HISTORY = 240 };
+
+	FrameStats();
+
+	void AddFrame(float frame_ms, unsigned int draw_calls, unsigned int visible_tiles);
+
+	// Frame time that the given fraction of the recent frames didn't go over
+	float Percentile(float fraction) const;
+
+	// One line with the percentiles, the draw calls and the visible tiles
+	void Summary(char * text, size_t size) const;
+
+	// Bar graph of the recent frames, with marks at 60 and 30 fps. Takes a
+	// single draw call.
+	void DrawGraph(sf::RenderTarget & target, float x, float y) const;
+
+	inline unsigned int NumFrames() const {
+		return Count;
+	}
+
+private:
+	float Times[HISTORY];
+	unsigned int Count;
+	unsigned int Next;
+	unsigned int DrawCalls;
+	unsigned int VisibleTiles;
+};
+
+#endif // FRAMESTATS_H_6B2D91C8_4F10_11E3_9A4E_525400DA3F0D
@@ -0,0 +1,129 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "heightmap.h"
+
+#include <cstdlib>
+#include <cctype>
+
+// Big enough to let the disk, and not the reads, set the pace
+static const size_t FileBufferSize = 1 << 20;
+
+HeightmapReader::HeightmapReader() :
+		File(NULL),
+		ImageWidth(0),
+		ImageHeight(0),
+		MaxValue(0),
+		BytesPerPixel(1),
+		RowData(NULL),
+		ScaleMin(0),
+		ScaleMax(0) {
+}
+
+HeightmapReader::~HeightmapReader() {
+	Close();
+}
+
+void HeightmapReader::Close() {
+	if (File) fclose(File);
+	File = NULL;
+	delete[] RowData;
+	RowData = NULL;
+	Scale.clear();
+}
+
+// Numbers in the header are separated by whitespace and comments, from # to
+// the end of the line
+bool HeightmapReader::ReadHeaderNumber(unsigned int & value) {
+	int c = fgetc(File);
+	for (;;) {
+		if (c == '#') {
+			while (c != '\n' && c != EOF) c = fgetc(File);
+		} else if (c != EOF && isspace(c)) {
+			c = fgetc(File);
+		} else {
+			break;
+		}
+	}
+	if (c == EOF || !isdigit(c)) return false;
+	value = 0;
+	while (c != EOF && isdigit(c)) {
+		if (value > 100000000) return false;
+		value = value * 10 + (c - '0');
+		c = fgetc(File);
+	}
+	// A single whitespace character comes between the header and the pixels
+	return c != EOF && isspace(c);
+}
+
+bool HeightmapReader::Open(const char * filename) {
+	Close();
+	File = fopen(filename, "rb");
+	if (!File) return false;
+	setvbuf(File, NULL, _IOFBF, FileBufferSize);
+
+	if (fgetc(File) != 'P' || fgetc(File) != '5' ||
+			!ReadHeaderNumber(ImageWidth) || !ReadHeaderNumber(ImageHeight) ||
+			!ReadHeaderNumber(MaxValue) ||
+			ImageWidth == 0 || ImageHeight == 0 || MaxValue == 0 || MaxValue > 65535) {
+		printf("%s isn't a binary grayscale PGM image\n", filename);
+		Close();
+		return false;
+	}
+
+	BytesPerPixel = MaxValue < 256 ? 1 : 2;
+	RowData = new unsigned char[(size_t)ImageWidth * BytesPerPixel];
+	return true;
+}
+
+bool HeightmapReader::ReadRow(signed int * row, signed int min, signed int max) {
+	if (!File) return false;
+	if (fread(RowData, (size_t)ImageWidth * BytesPerPixel, 1, File) != 1) return false;
+
+	// Every value of the image is rescaled only once, rounding to the nearest
+	if (Scale.empty() || min != ScaleMin || max != ScaleMax) {
+		Scale.resize(MaxValue + 1);
+		int64_t range = (int64_t)max - min;
+		for (unsigned int v = 0; v <= MaxValue; ++v) {
+			Scale[v] = min + (signed int)((2 * range * v + MaxValue) / (2 * (int64_t)MaxValue));
+		}
+		ScaleMin = min;
+		ScaleMax = max;
+	}
+
+	// 16 bit values are big endian; anything above the maximum is clamped
+	if (BytesPerPixel == 1) {
+		for (unsigned int x = 0; x < ImageWidth; ++x) {
+			unsigned int value = RowData[x];
+			row[x] = Scale[value < MaxValue ? value : MaxValue];
+		}
+	} else {
+		for (unsigned int x = 0; x < ImageWidth; ++x) {
+			unsigned int value = (RowData[2*x] << 8) | RowData[2*x + 1];
+			row[x] = Scale[value < MaxValue ? value : MaxValue];
+		}
+	}
+	return true;
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef HEIGHTMAP_H_2F8B6D40_4F3B_11E3_A7E9_525400DA3F0D
+#define HEIGHTMAP_H_2F8B6D40_4F3B_11E3_A7E9_525400DA3F0D
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+// Grayscale heightmap in a binary PGM file (P5), with 8 or 16 bits for each
+// pixel, read one row at a time, so that no more than a row of the image is
+// ever held in memory, however big it is.
+class HeightmapReader {
+public:
+	HeightmapReader();
+	~HeightmapReader();
+
+	// Reads the header, leaving the file at the first row
+	bool Open(const char * filename);
+	void Close();
+
+	inline unsigned int Width() const {
+		return ImageWidth;
+	}
+	inline unsigned int Height() const {
+		return ImageHeight;
+	}
+
+	// Next row of the image, rescaled from black to white into [min, max]
+	bool ReadRow(signed int * row, signed int min, signed int max);
+
+private:
+	bool ReadHeaderNumber(unsigned int & value);
+
+	FILE * File;
+	unsigned int ImageWidth;
+	unsigned int ImageHeight;
+	unsigned int MaxValue;
+	unsigned int BytesPerPixel;
+	unsigned char * RowData;
+	std::vector<signed int> Scale; // Elevation of each value, for the last min and max
+	signed int ScaleMin;
+	signed int ScaleMax;
+};
+
+#endif // HEIGHTMAP_H_2F8B6D40_4F3B_11E3_A7E9_525400DA3F0D
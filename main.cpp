@@ -24,6 +24,17 @@
 // THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "tileset.h"
+#include "tileatlas.h"
+#include "patterncache.h"
+#include "map.h"
+#include "mapwriter.h"
+#include "framestats.h"
+#include "overview.h"
+#include "validator.h"
+#include "collision.h"
+#include "pathfinder.h"
+#include "seedsearch.h"
+#include "heightmap.h"
 
 #include <sys/types.h>
 #include <SFML/Graphics.hpp>
@@ -36,442 +47,370 @@
 #include <climits>
 #include <cstdint>
 #include <iostream>
+#include <atomic>
+#include <thread>
 
-#define VERY_HIGH INT_MAX
-#define VERY_LOW INT_MIN
-
-struct MapCell {
-	signed int Elevation;
-	signed int LayerElevRef;
-	unsigned char TileID;
-	TileSet::TileRuntime * TileRuntimeData;
-	struct {
-		bool FixedTile : 1;
-		bool Ignore : 1;
-		bool GrowUp : 1;
-		bool GrowDown : 1;
-	};
-};
-
-struct MapLayer {
-	TileSet * Tiles;
-	signed int Elevation;
-};
-
-struct Map {
-	Map(unsigned int w, unsigned int h, signed int min_elev, signed int max_elev) :
-	Width(w), Height(h), Layers(NULL), MaxElevation(max_elev), MinElevation(min_elev) {
-		Cells = new MapCell[h*w];
-		memset(Cells, 0, h*w*sizeof(MapCell));
-	}
+static void Usage(const char * program)
+{
+	printf("Usage: %s [options]\n", program);
+	printf("  --size <width>x<height>  Size of the map in tiles\n");
+	printf("  --blocks                 Store the cells in 64x64 blocks\n");
+	printf("  --cells-file <file>      Map the cells to a scratch file, for maps bigger than the memory\n");
+	printf("  --stripe <rows>          Generate the map in stripes of that many rows\n");
+	printf("  --time <ms>              Time budget for solving the whole map\n");
+	printf("  --layer-time <ms>        Time budget for solving each layer\n");
+	printf("  --patch-up               Quickly fix the wrong tiles left by the solver\n");
+	printf("  --vsync                  Draw in sync with the display\n");
+	printf("  --fps <n>                Draw at most n frames per second, 0 for no limit (60)\n");
+	printf("  --frame-log              Print the frame statistics every few seconds\n");
+	printf("  --heatmap <file>         Save an image of where the edges of the tiles don't match\n");
+	printf("  --collision <n>          Find the walkable regions, with n x n parts for each tile (1, 2, 4)\n");
+	printf("  --heightmap <file>       Elevation from a grayscale PGM image, 8 or 16 bits; the map takes its size\n");
+	printf("  --seed <n>               Seed of the map, or the first one to try with --search\n");
+	printf("  --search <n>             Look for n seeds that meet the constraints below, and show the first one\n");
+	printf("  --search-tries <n>       Give up the search after n seeds (1000)\n");
+	printf("  --solid <l>:<min>:<max>  Fraction of the map solid in the layer l (1, 2, 3)\n");
+	printf("  --min-region <cells>     Cells in the largest area of ground of the starting layer\n");
+	printf("  --tmx <file>             Export the map to Tiled, CSV layer data\n");
+	printf("  --tmx64 <file>           Export the map to Tiled, base64 layer data\n");
+	printf("  --csv <prefix>           Export each layer to <prefix><layer>.csv\n");
+}
 
-	~Map() {
-		delete[] Cells;
-	}
+int main(int argc, char * argv[])
+{
+	srand((unsigned)time(0));
 
-	inline unsigned int getWidth() { return Width; }
-	inline unsigned int getHeight() { return Height; }
-
-	void GaussianBlur(float radius)
-	{
-		float temp[Width * Height];
-		float sigma2 = radius*radius;
-		unsigned int size = 7;
-
-		for(unsigned int y = 0; y < Height; ++y) {
-			for(unsigned int x = 0; x < Width; ++x) {
-				float value = 0;
-				float sum = 0;
-				unsigned int min_i = x > size ? x - size : 0;
-				unsigned int max_i = x + size < Width - 1 ? x + size : Width - 1;
-				for(unsigned int i = min_i; i <= max_i; ++i) {
-					float inc = i-x;
-					float factor = exp(-inc*inc / (2*sigma2));
-					sum += factor;
-					value += factor * Cells[i + y * Width].Elevation;
-				};
-				temp[x + y * Width] = value / sum;
-			};
-		};
-
-		for(unsigned int y = 0; y < Height; ++y) {
-			for(unsigned int x = 0; x < Width; ++x) {
-				float value = 0;
-				float sum = 0;
-				unsigned int min_i = y > size ? y - size : 0;
-				unsigned int max_i = y + size < Height - 1 ? y + size : Height - 1;
-				for(unsigned int i = min_i; i <= max_i; i++) {
-					float inc = i-y;
-					float factor = exp(-inc*inc / (2*sigma2));
-					sum += factor;
-					value += factor * temp[x + i * Width];
-				};
-				Cells[x + y * Width].Elevation = value / sum;
-			};
-		};
+	unsigned int map_width = 32*5;
+	unsigned int map_height = 24*5;
+	IMapWriter * writer = NULL;
+	bool blocks = false;
+	const char * cells_file = NULL;
+	unsigned int stripe_rows = 0;
+	unsigned int total_ms = 0;
+	unsigned int layer_ms = 0;
+	bool patch_up = false;
+	bool vsync = false;
+	unsigned int fps_limit = 60;
+	bool frame_log = false;
+	const char * heatmap_file = NULL;
+	unsigned int collision_resolution = 0;
+	bool seed_given = false;
+	uint32_t seed = 0;
+	unsigned int search_count = 0;
+	unsigned int search_tries = 1000;
+	struct SolidFraction {
+		unsigned int Layer;
+		float Min;
+		float Max;
 	};
-
-	void ResetMapCell(unsigned int x, unsigned int y) {
-		if (x < 0 || x > Width) return;
-		if (y < 0 || y > Height) return;
-		if (Cells[x+y*Width].FixedTile || Cells[x+y*Width].Ignore) return;
-
-		const TileSet * Tiles = CurrentLayer->Tiles;
-
-		if (Cells[x+y*Width].Elevation >= CurrentLayer->Elevation) {
-			Cells[x+y*Width].TileID = Tiles->SolidTile();
+	std::vector<SolidFraction> solid_fractions;
+	size_t min_region = 0;
+	const char * heightmap_file = NULL;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--size") && i + 1 < argc &&
+				sscanf(argv[i+1], "%ux%u", &map_width, &map_height) == 2) {
+			++i;
+		} else if (!strcmp(argv[i], "--blocks")) {
+			blocks = true;
+		} else if (!strcmp(argv[i], "--cells-file") && i + 1 < argc) {
+			cells_file = argv[++i];
+		} else if (!strcmp(argv[i], "--stripe") && i + 1 < argc &&
+				sscanf(argv[i+1], "%u", &stripe_rows) == 1) {
+			++i;
+		} else if (!strcmp(argv[i], "--time") && i + 1 < argc &&
+				sscanf(argv[i+1], "%u", &total_ms) == 1) {
+			++i;
+		} else if (!strcmp(argv[i], "--layer-time") && i + 1 < argc &&
+				sscanf(argv[i+1], "%u", &layer_ms) == 1) {
+			++i;
+		} else if (!strcmp(argv[i], "--patch-up")) {
+			patch_up = true;
+		} else if (!strcmp(argv[i], "--vsync")) {
+			vsync = true;
+		} else if (!strcmp(argv[i], "--fps") && i + 1 < argc &&
+				sscanf(argv[i+1], "%u", &fps_limit) == 1) {
+			++i;
+		} else if (!strcmp(argv[i], "--frame-log")) {
+			frame_log = true;
+		} else if (!strcmp(argv[i], "--heatmap") && i + 1 < argc) {
+			heatmap_file = argv[++i];
+		} else if (!strcmp(argv[i], "--collision") && i + 1 < argc &&
+				sscanf(argv[i+1], "%u", &collision_resolution) == 1) {
+			++i;
+		} else if (!strcmp(argv[i], "--heightmap") && i + 1 < argc) {
+			heightmap_file = argv[++i];
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < argc &&
+				sscanf(argv[i+1], "%u", &seed) == 1) {
+			seed_given = true;
+			++i;
+		} else if (!strcmp(argv[i], "--search") && i + 1 < argc &&
+				sscanf(argv[i+1], "%u", &search_count) == 1) {
+			++i;
+		} else if (!strcmp(argv[i], "--search-tries") && i + 1 < argc &&
+				sscanf(argv[i+1], "%u", &search_tries) == 1) {
+			++i;
+		} else if (!strcmp(argv[i], "--solid") && i + 1 < argc) {
+			SolidFraction fraction;
+			if (sscanf(argv[i+1], "%u:%f:%f", &fraction.Layer, &fraction.Min, &fraction.Max) != 3 ||
+					fraction.Layer < 1 || fraction.Layer > 3) {
+				Usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			solid_fractions.push_back(fraction);
+			++i;
+		} else if (!strcmp(argv[i], "--min-region") && i + 1 < argc &&
+				sscanf(argv[i+1], "%zu", &min_region) == 1) {
+			++i;
+		} else if (!strcmp(argv[i], "--tmx") && i + 1 < argc) {
+			delete writer;
+			writer = new TmxWriter(argv[++i], TmxWriter::ENCODING_CSV);
+		} else if (!strcmp(argv[i], "--tmx64") && i + 1 < argc) {
+			delete writer;
+			writer = new TmxWriter(argv[++i], TmxWriter::ENCODING_BASE64);
+		} else if (!strcmp(argv[i], "--csv") && i + 1 < argc) {
+			delete writer;
+			writer = new CsvWriter(argv[++i]);
 		} else {
-			Cells[x+y*Width].TileID = Tiles->EmptyTile();
+			Usage(argv[0]);
+			return EXIT_FAILURE;
 		}
 	}
 
-	bool AdjustTiles(unsigned int iterations = 300) {
-		const TileSet * Tiles = CurrentLayer->Tiles;
-		bool tiles_ok[Width * Height];
-		unsigned int wrong_resets = 0;
-		for (unsigned int k=0; k<iterations; ++k) {
-			unsigned int changes = 0;
-			unsigned int wrong = 0;
-			unsigned int y0 = rand() % Height;
-			for (unsigned int yi=0; yi<Height; ++yi) {
-				unsigned int y = (y0+yi) % Height;
-				unsigned int x0 = rand() % Width;
-				for (unsigned int xi=0; xi<Width; ++xi) {
-					unsigned int x = (x0+xi) % Width;
-					int best_err = -1;
-					if (!Cells[x + y*Width].FixedTile && !Cells[x + y*Width].Ignore) {
-						unsigned char best_tile = 0;
-						best_err = -1;
-						int c0 = rand() % (Tiles->NumTiles());
-						for (unsigned int ci = 0; ci < Tiles->NumTiles(); ++ci) {
-							int c = (c0+ci) % (Tiles->NumTiles()); // Current tile
-							int e = 0;  // Error
-
-							// Checking the tile to the left
-							if (x > 0) {
-								int d = Cells[(x-1)+y*Width].TileID;
-								e += Tiles->EdgesMatchError(Tiles->EdgeRight(d),
-									Tiles->EdgeLeft(c))*3;
-							} else {
-								int d = Cells[(x+1)+y*Width].TileID;
-								e += Tiles->EdgesMatchError(Tiles->HMirrorEdge(Tiles->EdgeLeft(d)),
-									Tiles->EdgeLeft(c))*3; // Mirror
-							}
-
-							// Checking the tile to the right
-							if (x < Width - 1) {
-								int d = Cells[(x+1)+y*Width].TileID;
-								e += Tiles->EdgesMatchError(Tiles->EdgeRight(c),
-									 Tiles->EdgeLeft(d))*3;
-							} else {
-								int d = Cells[(x-1)+y*Width].TileID;
-								e += Tiles->EdgesMatchError(Tiles->EdgeRight(c),
-									Tiles->HMirrorEdge(Tiles->EdgeRight(d)))*3; // Mirror
-							}
-
-							// Checking the tile above
-							if (y > 0) {
-								int d = Cells[x+(y-1)*Width].TileID;
-								e += Tiles->EdgesMatchError(Tiles->EdgeDown(d),
-									Tiles->EdgeUp(c))*3;
-							} else {
-								int d = Cells[x+(y+1)*Width].TileID;
-								e += Tiles->EdgesMatchError(Tiles->VMirrorEdge(Tiles->EdgeUp(d)),
-									Tiles->EdgeUp(c))*3; // Mirror
-							}
-
-							// Checking the tile below
-							if (y < Height - 1) {
-								int d = Cells[x+(y+1)*Width].TileID;
-								e += Tiles->EdgesMatchError(Tiles->EdgeDown(c),
-									Tiles->EdgeUp(d))*3;
-							} else {
-								int d = Cells[x+(y-1)*Width].TileID;
-								e += Tiles->EdgesMatchError(Tiles->EdgeDown(c),
-									Tiles->VMirrorEdge(Tiles->EdgeDown(d)))*3; // Mirror
-							}
-
-							if (best_err == -1 || e < best_err) {
-								best_tile = c;
-								best_err = e;
-							}
-						} // for (unsigned int ci = 0; ci < Tiles->NumTiles(); ++ci)
-
-						if (Cells[x+y*Width].TileID != best_tile) ++changes;
-						Cells[x+y*Width].TileID = best_tile;
-						if (best_err) {
-							tiles_ok[x+y*Width] = false;
-							++wrong;
-							if (rand() % 100 <= 5) {
-								ResetMapCell(x, y);
-							}
-						} else {
-							tiles_ok[x+y*Width] = true;
-						}
-					} // if (!Cells[x + y*Width].FixedTile && !Cells[x + y*Width].Ignore)
-				} // for (unsigned int xi=0; xi<Width; ++xi)
-			} // for (unsigned int yi=0; yi<Height; ++yi)
-			printf("Iter=%d, Changes= %d, Wrong=%d\n", k, changes, wrong);
-			if (wrong && !changes) {
-				for (unsigned int y=0; y<Height; ++y) {
-					for (unsigned int x=0; x<Width; ++x) {
-						if (!tiles_ok[x+y*Width]) {
-							ResetMapCell(x, y);
-							if (wrong_resets > 2) {
-								ResetMapCell(x-1, y);
-								ResetMapCell(x+1, y);
-								ResetMapCell(x, y-1);
-								ResetMapCell(x, y+1);
-							}
-						}
-					}
-				}
-				++wrong_resets;
-			}
-			if (!changes && !wrong) return true; // No wrong tiles
-		} // for (unsigned int k=0; k<iterations; ++k
-		return false; // We still have wrong tiles, but we give up
+	// The map takes the size of the heightmap, which is only read later on
+	HeightmapReader heightmap;
+	if (heightmap_file) {
+		if (!heightmap.Open(heightmap_file)) {
+			printf("Unable to open the heightmap %s\n", heightmap_file);
+			return EXIT_FAILURE;
+		}
+		map_width = heightmap.Width();
+		map_height = heightmap.Height();
 	}
 
-	void SetupInitialTiles() {
-		const TileSet * Tiles = CurrentLayer->Tiles;
-		for (unsigned int y=0; y<Height; ++y) {
-			for (unsigned int x=0; x<Width; ++x) {
-				if (!Cells[x + y*Width].FixedTile && !Cells[x + y*Width].Ignore) {
-					Cells[x + y*Width].LayerElevRef = CurrentLayer->Elevation;
-	
-					unsigned int xm = x > 0        ? x - 1 : x;
-					unsigned int xp = x < Width-1  ? x + 1 : x;
-					unsigned int ym = y > 0        ? y - 1 : y;
-					unsigned int yp = y < Height-1 ? y + 1 : y;
-
-					bool c =  (Cells[ x  + y  *Width].Elevation >= CurrentLayer->Elevation);
-					bool l =  (Cells[ xm + y  *Width].Elevation >= CurrentLayer->Elevation);
-					bool r =  (Cells[ xp + y  *Width].Elevation >= CurrentLayer->Elevation);
-					bool u =  (Cells[ x  + yp *Width].Elevation >= CurrentLayer->Elevation);
-					bool d =  (Cells[ x  + ym *Width].Elevation >= CurrentLayer->Elevation);
-					bool ul = (Cells[ xm + yp *Width].Elevation >= CurrentLayer->Elevation);
-					bool ur = (Cells[ xp + yp *Width].Elevation >= CurrentLayer->Elevation);
-					bool dl = (Cells[ xm + ym *Width].Elevation >= CurrentLayer->Elevation);
-					bool dr = (Cells[ xp + ym *Width].Elevation >= CurrentLayer->Elevation);
-
-					if (!u && !d && !l && !r) c = false;
-					if (u && d && l && r) c = true;
-
-					Cells[x+y*Width].TileID = Tiles->SolidTile();
-					//Cells[x+y*Width].FixedTile = false;
-					//Cells[x+y*Width].Ignore = false;
-
-					if (c & u & d & l & r) {
-						Cells[x+y*Width].TileID = Tiles->SolidTile();
-						//if (ul & ur & dl & dr) {
-						//	Cells[x+y*Width].FixedTile = true;
-						//}
-					} else if (!c & !u & !d & !l & !r) {
-						Cells[x+y*Width].TileID = Tiles->EmptyTile();
-						//if (!ul & !ur & !dl & !dr) {
-						//	Cells[x+y*Width].FixedTile = true;
-						//}
-					} else {
-						uint32_t env =
-							(ul?0x100:0)+( u?0x080:0)+(ur?0x040:0)+
-							( l?0x020:0)+( c?0x010:0)+( r?0x008:0)+
-							(dl?0x004:0)+( d?0x002:0)+(dr?0x001:0);
-						Cells[x+y*Width].TileID = Tiles->InitialTileGuess(env);
-					}
-				} // if (!Cells[x + y*Width].FixedTile && !Cells[x + y*Width].Ignore)
-			} // for (unsigned int x=0; x<Width; ++x)
-		} // for (unsigned int y=0; y<Height; ++y)
+	// The window comes first, so that there is something to look at while
+	// the map is being generated
+	sf::RenderWindow app(sf::VideoMode(1024, 768, 32), "SFML TileMap");
+	if (vsync) {
+		app.setVerticalSyncEnabled(true);
+	} else if (fps_limit) {
+		app.setFramerateLimit(fps_limit);
 	}
+	app.clear();
+	app.display();
 
-	void Random() {
-		memset(Cells, 0, Height*Width*sizeof(MapCell));
+	// The images of all the tiles are decoded only when they change
+	TileSet tiles1;
+	TileSet tiles2;
+	TileSet tiles3;
+	TileAtlas atlas;
+	atlas.Add(tiles1, "tiles/1");
+	atlas.Add(tiles2, "tiles/2");
+	atlas.Add(tiles3, "tiles/3");
+	if (!atlas.Load("tiles.cache"))
+		return EXIT_FAILURE;
 
-		for (unsigned int y=0; y<Height; ++y) {
-			for (unsigned int x=0; x<Width; ++x) {
-				Cells[x+y*Width].Elevation = MinElevation + (rand() % (MaxElevation - MinElevation));
-				Cells[x+y*Width].FixedTile = false;
-			}
-		}
+	MapLayer layers[] = { { NULL , VERY_LOW }, { &tiles1 , -4 }, { &tiles2 , 0 }, { &tiles3 , 8 }, { NULL , VERY_HIGH } };
 
-		GaussianBlur(5);
+	// Wide maps miss the cache on every vertical neighbour without blocks
+	if (map_width >= 4096) blocks = true;
 
-		for(unsigned int y = 0; y < Height; ++y) {
-			for(unsigned int x = 0; x < Width; ++x) {
-				printf("%3d ", Cells[x+y*Width].Elevation);
-			}
+	// A mapped map is only worth it if it isn't touched all at once
+	if (cells_file && !stripe_rows) stripe_rows = 256;
+
+	Map map(map_width, map_height, -100, 100, blocks ? Map::LAYOUT_BLOCKS : Map::LAYOUT_ROWS, cells_file);
+	map.SetLayers(layers);
+	map.SetStartingLayer(2);
+	map.SetStripeRows(stripe_rows);
+	map.SetTimeBudget(layer_ms, total_ms);
+	map.SetPatchUp(patch_up);
+	map.SetWriter(writer);
+
+	// The map is generated in the background, and shown as its rows get ready
+	PatternCache patterns(&tiles1);
+	MapOverview overview;
+	MapValidator validator(map);
+	CollisionGrid collision;
+	PathFinder paths;
+	SeedSearch search(map, cells_file);
+	for (unsigned int i = 0; i < solid_fractions.size(); ++i) {
+		search.SetSolidFraction(solid_fractions[i].Layer, solid_fractions[i].Min, solid_fractions[i].Max);
+	}
+	search.SetMinRegion(min_region);
+	std::atomic<bool> generated(false);
+	std::atomic<bool> failed(false);
+	std::thread generator([&] {
+		// All the layers share the same rules, so they can share the same patterns
+		if (!patterns.Load("patterns.cache")) {
+			printf("Building pattern cache\n");
+			unsigned int rejected = patterns.Build();
+			if (patterns.Stopped()) return;
+			if (rejected) printf("%u patterns have no matching block, and keep their guess\n", rejected);
+			if (!patterns.Save("patterns.cache"))
+				printf("Unable to save pattern cache\n");
+		}
+		tiles1.SetPatternCache(&patterns);
+		tiles2.SetPatternCache(&patterns);
+		tiles3.SetPatternCache(&patterns);
+
+		// Candidates are only blurred, the tiles are solved for the chosen one
+		if (search_count && !heightmap_file) {
+			if (!seed_given) seed = rand();
+			std::vector<uint32_t> seeds = search.Find(search_count, seed, search_tries);
+			printf("%zu of %u seeds tried meet the constraints:", seeds.size(), search.Tries());
+			for (unsigned int i = 0; i < seeds.size(); ++i) printf(" %u", seeds[i]);
 			printf("\n");
+			seed_given = !seeds.empty();
+			if (seed_given) seed = seeds[0];
+			if (map.Stopping) return;
 		}
-		printf("\n");
-	}
 
-	void AddTiles()
-	{
-		// Central layer
-		CurrentLayer = StartingLayer;
-		TileSet * tiles = CurrentLayer->Tiles;
-		unsigned int empty_tile = tiles->EmptyTile();
-		unsigned int solid_tile = tiles->SolidTile();
-
-		for(unsigned int y = 0; y < Height; ++y) {
-			for(unsigned int x = 0; x < Width; ++x) {
-				Cells[x+y*Width].FixedTile = false;
-				Cells[x+y*Width].Ignore = false;
-				Cells[x+y*Width].TileRuntimeData = &tiles->GetTileRuntimeData(empty_tile);
+		// The constraints are measured as the rows are made, not read again
+		SeedSearch::Measure measure(search);
+		Map::RowsTask measure_rows;
+		if (search_count) {
+			measure_rows = [&](unsigned int y_begin, unsigned int y_end) {
+				measure.AddRows(map, y_begin, y_end);
+			};
+		}
+		if (heightmap_file) {
+			bool imported = map.Import(heightmap, measure_rows);
+			heightmap.Close();
+			if (map.Stopping) return;
+			if (!imported) {
+				printf("Unable to import the heightmap %s\n", heightmap_file);
+				failed = true;
+				generated = true;
+				return;
 			}
+		} else if (seed_given) {
+			map.Random(seed, measure_rows);
+		} else {
+			map.Random(measure_rows);
 		}
-
-		for (unsigned int tries = 0 ; tries < 2; ++tries) {
-			SetupInitialTiles();
-			if (AdjustTiles()) break;
+		if (!heightmap_file) printf("Seed %u\n", map.GetSeed());
+		if (search_count) {
+			SeedSearch::Stats stats;
+			measure.Finish(stats);
+			printf("Solid fractions %.3f %.3f %.3f\n", stats.Solid[1], stats.Solid[2], stats.Solid[3]);
+			if (stats.LargestRegion) printf("Largest area of ground: %zu cells\n", stats.LargestRegion);
 		}
 
-		for(unsigned int y = 0; y < Height; ++y) {
-			for(unsigned int x = 0; x < Width; ++x) {
-				unsigned int tile_id = Cells[x+y*Width].TileID;
-				Cells[x+y*Width].TileRuntimeData = &tiles->GetTileRuntimeData(tile_id);
-				if (tile_id == solid_tile) Cells[x+y*Width].GrowUp = true;
-				else if (tile_id == empty_tile) Cells[x+y*Width].GrowDown = true;
-			}
+		unsigned int wrong = map.AddTiles();
+		if (map.Stopping) return;
+		if (wrong) printf("%u wrong tiles left\n", wrong);
+		map.SetWriter(NULL);
+
+		// Checked as shown, layers stitched together included. Each of the
+		// stages from here on is stopped along with the map, and the thread
+		// gives up as soon as one of them is.
+		unsigned int conflicts = validator.Validate();
+		if (map.Stopping) return;
+		printf("%u edges don't match\n", conflicts);
+		for (unsigned int i = 0; i < validator.Locations().size() && i < 10; ++i) {
+			const MapValidator::Conflict & conflict = validator.Locations()[i];
+			printf("  (%u, %u) and the tile %s\n", conflict.X, conflict.Y, conflict.Vertical ? "below" : "to the right");
 		}
-
-		// Upper layer
-		CurrentLayer = StartingLayer + 1;
-		tiles = CurrentLayer->Tiles;
-		if (tiles != NULL) {
-			empty_tile = tiles->EmptyTile();
-			solid_tile = tiles->SolidTile();
-
-			for(unsigned int y = 0; y < Height; ++y) {
-				for(unsigned int x = 0; x < Width; ++x) {
-					if (!Cells[x+y*Width].FixedTile) {
-						Cells[x+y*Width].TileID = empty_tile;
-						if (Cells[x+y*Width].GrowUp) {
-							Cells[x+y*Width].Ignore = false;
-						} else {
-							Cells[x+y*Width].Ignore = true;
-						}
-					}
+		if (heatmap_file && !validator.SaveHeatmap(heatmap_file))
+			printf("Unable to save the heatmap\n");
+
+		// Walking on the ground of the starting layer
+		if (collision_resolution) {
+			bool built = collision.Build(map, collision_resolution, 2);
+			if (map.Stopping) return;
+			if (built) {
+				size_t largest = 0;
+				for (unsigned int r = 1; r <= collision.NumRegions(); ++r) {
+					if (collision.RegionSize(r) > largest) largest = collision.RegionSize(r);
 				}
+				printf("%u walkable regions, the largest with %zu of %ux%u parts of tiles\n",
+					collision.NumRegions(), largest, collision.Width(), collision.Height());
+				paths.Build(collision);
+				if (map.Stopping) return;
+				printf("%u entrances between the clusters of the path finder\n", paths.NumNodes());
+			} else {
+				printf("Unable to build the collision grid, %u parts of each tile\n", collision_resolution);
 			}
-
-			for (unsigned int tries = 0 ; tries < 2; ++tries) {
-				SetupInitialTiles();
-				if (AdjustTiles()) break;
-			}
-
-			for(unsigned int y = 0; y < Height; ++y) {
-				for(unsigned int x = 0; x < Width; ++x) {
-					if (Cells[x+y*Width].GrowUp) {
-						unsigned int tile_id = Cells[x+y*Width].TileID;
-						Cells[x+y*Width].TileRuntimeData = &tiles->GetTileRuntimeData(tile_id);
-						if (tile_id == solid_tile) Cells[x+y*Width].GrowUp = true;
-						else if (tile_id == empty_tile) Cells[x+y*Width].GrowUp = false;
-					}
-				}
-			}
-
 		}
 
-		// Lower layer
-		CurrentLayer = StartingLayer - 1;
-		tiles = CurrentLayer->Tiles;
-		if (tiles != NULL) {
-			empty_tile = tiles->EmptyTile();
-			solid_tile = tiles->SolidTile();
-
-			for(unsigned int y = 0; y < Height; ++y) {
-				for(unsigned int x = 0; x < Width; ++x) {
-					if (!Cells[x+y*Width].FixedTile) {
-						Cells[x+y*Width].TileID = solid_tile;
-						if (Cells[x+y*Width].GrowDown) {
-							Cells[x+y*Width].Ignore = false;
-						} else {
-							Cells[x+y*Width].Ignore = true;
-						}
-					}
-				}
-			}
+		overview.Compute(map);
+		if (map.Stopping) return;
+		generated = true;
+	});
+	bool generating = true;
+
+	// Scrolling speed, in pixels per second
+	const float ScrollSpeed = 960;
+
+	// Beyond that many tiles on screen, each of them a draw call, the overview
+	// is drawn instead. Below that size they can't be told apart anyway.
+	const unsigned int MaxVisibleTiles = 4096;
+	const float MinTilePixels = 8;
+	const float MaxZoom = 4;
+
+	// Zoom out until the whole map fits in a few hundred pixels
+	float MinZoom = 1;
+	while (32 * MinZoom * (map_width > map_height ? map_width : map_height) > 256) MinZoom /= 2;
+
+	// Position of the top left corner of the screen in the map, at 1:1 scale,
+	// and screen pixels for each map pixel
+	float OffsetX = 0;
+	float OffsetY = 0;
+	float Zoom = 1;
+
+	// Keeps the map pixel under (x, y) on the screen where it is
+	auto ZoomAt = [&](float factor, float x, float y) {
+		float zoom = Zoom * factor;
+		if (zoom > MaxZoom) zoom = MaxZoom;
+		if (zoom < MinZoom) zoom = MinZoom;
+		OffsetX += x / Zoom - x / zoom;
+		OffsetY += y / Zoom - y / zoom;
+		Zoom = zoom;
+	};
 
-			for (unsigned int tries = 0 ; tries < 2; ++tries) {
-				SetupInitialTiles();
-				if (AdjustTiles()) break;
-			}
+	FrameStats stats;
+	bool show_stats = false;
+	bool show_conflicts = false;
 
-			for(unsigned int y = 0; y < Height; ++y) {
-				for(unsigned int x = 0; x < Width; ++x) {
-					if (Cells[x+y*Width].GrowDown) {
-						unsigned int tile_id = Cells[x+y*Width].TileID;
-						Cells[x+y*Width].TileRuntimeData = &tiles->GetTileRuntimeData(tile_id);
-						if (tile_id == solid_tile) Cells[x+y*Width].GrowUp = true;
-						else if (tile_id == empty_tile) Cells[x+y*Width].GrowUp = false;
-					}
-				}
-			}
+	// Right clicks pick the ends of a path, once there is a collision grid
+	bool path_started = false;
+	PathFinder::Point path_from = { 0, 0 };
+	std::vector<PathFinder::Point> path;
+	bool redraw = true;        // Something changed since the last frame
+	unsigned int frames = 0;   // Frames drawn since the last report
+	unsigned int reports = 0;
+	sf::Clock frame_clock;     // Time since the last update
+	sf::Clock report_clock;    // Time since the last report
 
+	// Start game loop
+	while (app.isOpen()) {
+		if (generating && generated) {
+			generator.join();
+			generating = false;
+			delete writer;
+			if (failed) return EXIT_FAILURE;
+			overview.Upload();
+			app.setTitle("SFML TileMap");
+			redraw = true;
 		}
 
-	}
-
-	inline void SetLayers(MapLayer layers[]) {
-		Layers = layers;
-		StartingLayer = &Layers[0];
-	}
-
-	inline void SetStartingLayer(int index) {
-		StartingLayer = &Layers[index];
-	}
-
-	inline MapLayer * GetCurrentLayer() {
-		return CurrentLayer;
-	}
-
-	unsigned int Width;
-	unsigned int Height;
-	MapLayer * Layers;
-	MapLayer * StartingLayer;
-	MapLayer * CurrentLayer;
-	MapCell *Cells;
-	signed int MaxElevation;
-	signed int MinElevation;
-};
-
-int main()
-{
-	srand((unsigned)time(0));
+		bool scrolling =
+			sf::Keyboard::isKeyPressed(sf::Keyboard::Left) ||
+			sf::Keyboard::isKeyPressed(sf::Keyboard::Right) ||
+			sf::Keyboard::isKeyPressed(sf::Keyboard::Up) ||
+			sf::Keyboard::isKeyPressed(sf::Keyboard::Down);
 
-	TileSet tiles1;
-	if (!tiles1.LoadTileTextures("tiles/1"))
-		return EXIT_FAILURE;
+		// Nothing changes on screen until something happens, so just wait for it
+		bool waited = !redraw && !scrolling && !generating;
+		bool waiting = waited;
 
-	TileSet tiles2;
-	if (!tiles2.LoadTileTextures("tiles/2"))
-		return EXIT_FAILURE;
-
-	TileSet tiles3;
-	if (!tiles3.LoadTileTextures("tiles/3"))
-		return EXIT_FAILURE;
-
-	MapLayer layers[] = { { NULL , VERY_LOW }, { &tiles1 , -4 }, { &tiles2 , 0 }, { &tiles3 , 8 }, { NULL , VERY_HIGH } };
-
-	Map map(32*5, 24*5, -100, 100);
-	map.SetLayers(layers);
-
-	map.Random();
-	map.SetStartingLayer(2);
-	map.AddTiles();
-
-	// Create the main rendering window
-	sf::RenderWindow app(sf::VideoMode(1024, 768, 32), "SFML TileMap");
-
-	signed int OffsetX = 0;
-	signed int OffsetY = 0;
-
-	// Start game loop
-	while (app.isOpen()) {
 		sf::Event event;
-		while (app.pollEvent(event))
+		while (waiting ? app.waitEvent(event) : app.pollEvent(event))
 		{ // http://www.sfml-dev.org/tutorials/1.6/window-events.php
+			waiting = false;
+			if (event.type != sf::Event::MouseMoved) {
+				redraw = true;
+			}
 
 			if (event.type == sf::Event::Closed) { // Exit when the window is closed
 				app.close();
@@ -497,6 +436,19 @@ int main()
 			}
 
 			if (event.type == sf::Event::KeyPressed) {
+				if (event.key.code == sf::Keyboard::Add || event.key.code == sf::Keyboard::Equal) {
+					ZoomAt(2, app.getSize().x / 2, app.getSize().y / 2);
+				}
+				if (event.key.code == sf::Keyboard::Subtract || event.key.code == sf::Keyboard::Dash) {
+					ZoomAt(0.5f, app.getSize().x / 2, app.getSize().y / 2);
+				}
+				if (event.key.code == sf::Keyboard::F3) {
+					show_stats = !show_stats;
+					if (!show_stats) app.setTitle("SFML TileMap");
+				}
+				if (event.key.code == sf::Keyboard::F4) {
+					show_conflicts = !show_conflicts;
+				}
 				if (event.key.code == sf::Keyboard::Escape) {
 					//std::cout << "the escape key was pressed" << std::endl;
 					//std::cout << "control:" << event.key.control << std::endl;
@@ -507,16 +459,38 @@ int main()
 			}
 
 			if (event.type == sf::Event::MouseWheelMoved) {
+				ZoomAt(event.mouseWheel.delta > 0 ? 2 : 0.5f, event.mouseWheel.x, event.mouseWheel.y);
 				//std::cout << "wheel movement: " << event.mouseWheel.delta << std::endl;
 				//std::cout << "mouse x: " << event.mouseWheel.x << std::endl;
 				//std::cout << "mouse y: " << event.mouseWheel.y << std::endl;
 			}
 
 			if (event.type == sf::Event::MouseButtonPressed) {
-				if (event.mouseButton.button == sf::Mouse::Right) {
+				if (event.mouseButton.button == sf::Mouse::Right && !generating && collision_resolution) {
 					//std::cout << "the right button was pressed" << std::endl;
 					//std::cout << "mouse x: " << event.mouseButton.x << std::endl;
 					//std::cout << "mouse y: " << event.mouseButton.y << std::endl;
+					float map_x = OffsetX + event.mouseButton.x / Zoom;
+					float map_y = OffsetY + event.mouseButton.y / Zoom;
+					PathFinder::Point point = { 0, 0 };
+					if (map_x >= 0) point.X = map_x * collision.Resolution() / 32;
+					if (map_y >= 0) point.Y = map_y * collision.Resolution() / 32;
+					if (!path_started) {
+						path_from = point;
+						path.clear();
+						path_started = true;
+					} else {
+						sf::Clock path_clock;
+						unsigned int cost = 0;
+						bool found = paths.FindPath(path_from, point, path, &cost);
+						int us = path_clock.getElapsedTime().asMicroseconds();
+						if (found) {
+							printf("Path with %u turns, cost %u, found in %d us\n", (unsigned int)path.size(), cost, us);
+						} else {
+							printf("No path, found out in %d us\n", us);
+						}
+						path_started = false;
+					}
 				}
 			}
 
@@ -554,47 +528,151 @@ int main()
 		bool UpKeyDown    = sf::Keyboard::isKeyPressed(sf::Keyboard::Up);
 		bool DownKeyDown  = sf::Keyboard::isKeyPressed(sf::Keyboard::Down);
 
-		if (LeftKeyDown) OffsetX -= 16;
-		if (RightKeyDown) OffsetX += 16;
-		if (UpKeyDown) OffsetY -= 16;
-		if (DownKeyDown) OffsetY += 16;
+		// The time spent waiting isn't scrolled
+		float elapsed = frame_clock.restart().asSeconds();
+		if (waited) elapsed = 0;
+
+		// The same speed on screen, whatever the zoom
+		if (LeftKeyDown) OffsetX -= ScrollSpeed * elapsed / Zoom;
+		if (RightKeyDown) OffsetX += ScrollSpeed * elapsed / Zoom;
+		if (UpKeyDown) OffsetY -= ScrollSpeed * elapsed / Zoom;
+		if (DownKeyDown) OffsetY += ScrollSpeed * elapsed / Zoom;
+		if (LeftKeyDown || RightKeyDown || UpKeyDown || DownKeyDown) redraw = true;
+		if (generating) redraw = true;
+
+		if (!redraw) continue;
+		redraw = false;
+
+		// Time taken to build the frame, without waiting for the display
+		sf::Clock render_clock;
+		unsigned int draw_calls = 0;
 
 		// Clear screen
 		app.clear();
 
-		// Get screen dimensions
+		unsigned int visible_tiles = 0;
+
+		// While the map is being generated, only the rows that are ready
+		std::unique_lock<std::mutex> display_lock(map.DisplayLock);
+		unsigned int ready_rows = map.ReadyRows;
+
+		// Tiles on screen, as if the whole map was ready
 		sf::Vector2u screen_size = app.getSize();
+		float screen_tiles = (screen_size.x / (32 * Zoom) + 1) * (screen_size.y / (32 * Zoom) + 1);
 
-		// Draw only the part of map shown in screen
-		unsigned int start_y = (OffsetY > 0 ? OffsetY : 0) / 32 + 1;
-		unsigned int end_y = (OffsetY + screen_size.y) / 32 - 1;
-		unsigned int start_x = (OffsetX > 0 ? OffsetX : 0) / 32 + 1;
-		unsigned int end_x = (OffsetX + screen_size.x) / 32 - 1;
-
-		// Careful with the limits of the map
-		start_y = start_y > 0 ? start_y : 0;
-		end_y = end_y < map.getHeight() ? end_y : map.getHeight();
-		start_x = start_x > 0 ? start_x : 0;
-		end_x = end_x < map.getWidth() ? end_x : map.getWidth();
-
-		for (unsigned int y=start_y; y<end_y; ++y) {
-			for (unsigned int x=start_x; x<end_x; ++x) {
-				// Get the tile's image and sprite
-				sf::Sprite & sprite = map.Cells[x+y*map.getWidth()].TileRuntimeData->Sprite;
-				const sf::Texture & texture = *sprite.getTexture();
-				// Get the width and height of the image
-				sf::Vector2u size = texture.getSize();
-				// Adjust the offset by using the width
-				sprite.setPosition(x * size.x - OffsetX, y * size.y - OffsetY);
-				// Draw the tile
-				app.draw(sprite);
+		if (32 * Zoom < MinTilePixels || screen_tiles > MaxVisibleTiles) {
+			draw_calls += overview.Draw(app, OffsetX, OffsetY, Zoom);
+		} else {
+			// Whole screen pixels, so that the tiles don't get blurred
+			signed int view_x = floorf(OffsetX * Zoom);
+			signed int view_y = floorf(OffsetY * Zoom);
+			signed int tile_pixels = 32 * Zoom;
+
+			// Draw only the part of map shown in screen
+			signed int start_y = (view_y > 0 ? view_y : 0) / tile_pixels + 1;
+			signed int end_y = (view_y + (signed int)screen_size.y) / tile_pixels - 1;
+			signed int start_x = (view_x > 0 ? view_x : 0) / tile_pixels + 1;
+			signed int end_x = (view_x + (signed int)screen_size.x) / tile_pixels - 1;
+
+			// Careful with the limits of the map
+			end_y = end_y < (signed int)ready_rows ? end_y : ready_rows;
+			end_x = end_x < (signed int)map.getWidth() ? end_x : map.getWidth();
+
+			for (signed int y=start_y; y<end_y; ++y) {
+				for (signed int x=start_x; x<end_x; ++x) {
+					// Get the tile's sprite, a part of the atlas
+					sf::Sprite & sprite = map.Cell(x, y).TileRuntimeData->Sprite;
+					// Get the width and height of the tile
+					const sf::IntRect & rect = sprite.getTextureRect();
+					// Adjust the offset by using the width
+					sprite.setScale(Zoom, Zoom);
+					sprite.setPosition(x * rect.width * Zoom - view_x, y * rect.height * Zoom - view_y);
+					// Draw the tile
+					app.draw(sprite);
+					++draw_calls;
+				}
+			}
+			visible_tiles = draw_calls;
+		}
+		display_lock.unlock();
+
+		if (generating) {
+			float progress = map.Progress();
+			sf::RectangleShape bar(sf::Vector2f(screen_size.x - 16, 8));
+			bar.setPosition(8, screen_size.y - 16);
+			bar.setFillColor(sf::Color(64, 64, 64));
+			app.draw(bar);
+			bar.setSize(sf::Vector2f((screen_size.x - 16) * progress, 8));
+			bar.setFillColor(sf::Color(0, 200, 0));
+			app.draw(bar);
+			draw_calls += 2;
+
+			char title[64];
+			snprintf(title, sizeof(title), "SFML TileMap - generating, %.0f%%", progress * 100);
+			app.setTitle(title);
+		}
+
+		if (path.size() > 1) {
+			// Through the middle of the parts of the tiles
+			float part = 32.0f / collision.Resolution();
+			sf::VertexArray lines(sf::LinesStrip);
+			for (unsigned int i = 0; i < path.size(); ++i) {
+				lines.append(sf::Vertex(sf::Vector2f(
+					((path[i].X + 0.5f) * part - OffsetX) * Zoom,
+					((path[i].Y + 0.5f) * part - OffsetY) * Zoom), sf::Color(255, 255, 0)));
 			}
+			app.draw(lines);
+			++draw_calls;
+		}
+
+		if (show_conflicts && !generating) {
+			validator.DrawOverlay(app, OffsetX, OffsetY, Zoom, 32);
+			++draw_calls;
 		}
 
+		if (show_stats) {
+			stats.DrawGraph(app, 8, 8);
+			++draw_calls;
+		}
+
+		float frame_ms = render_clock.getElapsedTime().asMicroseconds() / 1000.0f;
+
 		// Display window contents on screen
 		app.display();
 
-//		sf::Sleep(1.0f / 60.0f);
+		stats.AddFrame(frame_ms, draw_calls, visible_tiles);
+		++frames;
+
+		float report_time = report_clock.getElapsedTime().asSeconds();
+		if (report_time >= 1) {
+			char summary[128];
+			char text[160];
+			stats.Summary(summary, sizeof(summary));
+			snprintf(text, sizeof(text), "%.0f fps, %s", frames / report_time, summary);
+			if (show_stats) {
+				char title[192];
+				snprintf(title, sizeof(title), "SFML TileMap - %s", text);
+				app.setTitle(title);
+			}
+			if (frame_log && ++reports % 5 == 0) {
+				printf("%s\n", text);
+			}
+			frames = 0;
+			report_clock.restart();
+		}
+	}
+
+	if (generating) {
+		// The map first, as the generator checks it between the stages
+		map.Stop();
+		search.Stop();
+		patterns.Stop();
+		validator.Stop();
+		collision.Stop();
+		paths.Stop();
+		overview.Stop();
+		generator.join();
+		delete writer;
 	}
 
 	return EXIT_SUCCESS;
@@ -0,0 +1,861 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "map.h"
+#include "patterncache.h"
+#include "heightmap.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+Map::Map(unsigned int w, unsigned int h, signed int min_elev, signed int max_elev,
+		CellLayout layout, const char * backing_file) :
+		Width(w), Height(h), Layout(layout), StripeRows(0), OpenRow(UINT_MAX), LayerBudget(0), TotalBudget(0),
+		PatchUp(false), Layers(NULL), StartingLayer(NULL), CurrentLayer(NULL), Writer(NULL),
+		Pool(&ThreadPool::Instance()), Cells(NULL), CellsMapped(false),
+		ReadyRows(0), Stage(0), StageRows(0), Stopping(false),
+		MaxElevation(max_elev), MinElevation(min_elev), Seed(0) {
+	BlocksX = (w + BLOCK_MASK) >> BLOCK_SHIFT;
+	if (Layout == LAYOUT_BLOCKS) {
+		NumCells = (size_t)BlocksX * ((h + BLOCK_MASK) >> BLOCK_SHIFT) * BLOCK_SIZE * BLOCK_SIZE;
+	} else {
+		NumCells = (size_t)h*w;
+	}
+
+	if (backing_file) {
+		// The file is only scratch space for the cells, so it's removed right
+		// away; a freshly truncated file reads as zeros, so it needs no memset.
+		int fd = open(backing_file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fd >= 0 && ftruncate(fd, NumCells*sizeof(MapCell)) == 0) {
+			void * cells = mmap(NULL, NumCells*sizeof(MapCell), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (cells != MAP_FAILED) {
+				Cells = (MapCell *)cells;
+				CellsMapped = true;
+			}
+		}
+		if (fd >= 0) {
+			close(fd);
+			unlink(backing_file);
+		}
+		if (!CellsMapped) {
+			printf("Unable to map the cells to '%s', keeping them in memory\n", backing_file);
+		}
+	}
+
+	if (!CellsMapped) {
+		Cells = new MapCell[NumCells];
+		memset(Cells, 0, NumCells*sizeof(MapCell));
+	}
+}
+
+Map::~Map() {
+	if (CellsMapped) {
+		munmap(Cells, NumCells*sizeof(MapCell));
+	} else {
+		delete[] Cells;
+	}
+}
+
+void Map::GaussianBlur(float radius, const RowsTask & done)
+{
+	float sigma2 = radius*radius;
+	unsigned int size = 7;
+	unsigned int stripe = StripeRows && StripeRows < Height ? StripeRows : Height;
+
+	// The horizontal pass of the rows [t_begin, t_end) around each stripe.
+	// The first rows of a stripe have already been overwritten by the previous
+	// one, so their horizontal pass is carried over from it.
+	float * temp = new float[(size_t)(stripe + 2*size) * Width];
+	unsigned int t_begin = 0;
+	unsigned int t_end = 0;
+
+	for (unsigned int y0 = 0; y0 < Height; y0 += stripe) {
+		unsigned int y1 = y0 + stripe < Height ? y0 + stripe : Height;
+		unsigned int next_begin = y0 > size ? y0 - size : 0;
+		unsigned int next_end = y1 + size < Height ? y1 + size : Height;
+		unsigned int carried = t_end > next_begin ? t_end - next_begin : 0;
+		if (carried) {
+			memmove(temp, temp + (size_t)(next_begin - t_begin) * Width, (size_t)carried * Width * sizeof(float));
+		}
+		t_begin = next_begin;
+		t_end = next_end;
+		unsigned int h_begin = t_begin + carried;
+
+		// Each band of the vertical pass only needs the horizontal pass done
+		// on the bands that overlap it, plus the size rows around it.
+		const unsigned int band = 32;
+		TaskGraph graph;
+		std::vector<unsigned int> h_tasks;
+		for (unsigned int b = h_begin; b < t_end; b += band) {
+			unsigned int y_begin = b;
+			unsigned int y_end = b + band < t_end ? b + band : t_end;
+			float * rows = temp + (size_t)(y_begin - t_begin) * Width;
+			h_tasks.push_back(graph.Add([=] {
+				for(unsigned int y = y_begin; y < y_end; ++y) {
+					float * row = rows + (size_t)(y - y_begin) * Width;
+					for(unsigned int x = 0; x < Width; ++x) {
+						float value = 0;
+						float sum = 0;
+						unsigned int min_i = x > size ? x - size : 0;
+						unsigned int max_i = x + size < Width - 1 ? x + size : Width - 1;
+						for(unsigned int i = min_i; i <= max_i; ++i) {
+							float inc = i-x;
+							float factor = exp(-inc*inc / (2*sigma2));
+							sum += factor;
+							value += factor * Cell(i, y).Elevation;
+						};
+						row[x] = value / sum;
+					};
+				};
+			}));
+		}
+
+		unsigned int first_row = t_begin;
+		for (unsigned int b = y0; b < y1; b += band) {
+			unsigned int y_begin = b;
+			unsigned int y_end = b + band < y1 ? b + band : y1;
+			unsigned int task = graph.Add([=] {
+				for(unsigned int y = y_begin; y < y_end; ++y) {
+					for(unsigned int x = 0; x < Width; ++x) {
+						float value = 0;
+						float sum = 0;
+						unsigned int min_i = y > size ? y - size : 0;
+						unsigned int max_i = y + size < Height - 1 ? y + size : Height - 1;
+						for(unsigned int i = min_i; i <= max_i; i++) {
+							float inc = i-y;
+							float factor = exp(-inc*inc / (2*sigma2));
+							sum += factor;
+							value += factor * temp[x + (size_t)(i - first_row) * Width];
+						};
+						Cell(x, y).Elevation = value / sum;
+					};
+				};
+			});
+			unsigned int needed_begin = y_begin > size ? y_begin - size : 0;
+			for (unsigned int h = 0; h < h_tasks.size(); ++h) {
+				unsigned int h_first = h_begin + h * band;
+				if (h_first + band > needed_begin && h_first < y_end + size) {
+					graph.Precede(h_tasks[h], task);
+				}
+			}
+		}
+
+		graph.Run(*Pool);
+		StageRows = y1;
+		if (done) done(y0, y1);
+	}
+	delete[] temp;
+}
+
+void Map::ResetMapCell(unsigned int x, unsigned int y) {
+	if (x >= Width) return;
+	if (y >= Height) return;
+	if (Cell(x, y).FixedTile || Cell(x, y).Ignore) return;
+
+	const TileSet * Tiles = CurrentLayer->Tiles;
+
+	if (Cell(x, y).Elevation >= CurrentLayer->Elevation) {
+		Cell(x, y).TileID = Tiles->SolidTile();
+	} else {
+		Cell(x, y).TileID = Tiles->EmptyTile();
+	}
+}
+
+int Map::TileError(unsigned int x, unsigned int y, unsigned int c) const {
+	const TileSet * Tiles = CurrentLayer->Tiles;
+	int e = 0;  // Error
+
+	// Checking the tile to the left
+	if (x > 0) {
+		int d = Cell(x-1, y).TileID;
+		e += Tiles->EdgesMatchError(Tiles->EdgeRight(d),
+			Tiles->EdgeLeft(c))*3;
+	} else {
+		int d = Cell(x+1, y).TileID;
+		e += Tiles->EdgesMatchError(Tiles->HMirrorEdge(Tiles->EdgeLeft(d)),
+			Tiles->EdgeLeft(c))*3; // Mirror
+	}
+
+	// Checking the tile to the right
+	if (x < Width - 1) {
+		int d = Cell(x+1, y).TileID;
+		e += Tiles->EdgesMatchError(Tiles->EdgeRight(c),
+			 Tiles->EdgeLeft(d))*3;
+	} else {
+		int d = Cell(x-1, y).TileID;
+		e += Tiles->EdgesMatchError(Tiles->EdgeRight(c),
+			Tiles->HMirrorEdge(Tiles->EdgeRight(d)))*3; // Mirror
+	}
+
+	// Checking the tile above
+	if (y > 0) {
+		int d = Cell(x, y-1).TileID;
+		e += Tiles->EdgesMatchError(Tiles->EdgeDown(d),
+			Tiles->EdgeUp(c))*3;
+	} else {
+		int d = Cell(x, y+1).TileID;
+		e += Tiles->EdgesMatchError(Tiles->VMirrorEdge(Tiles->EdgeUp(d)),
+			Tiles->EdgeUp(c))*3; // Mirror
+	}
+
+	// Checking the tile below
+	if (y + 1 == OpenRow) {
+		// Solved again with the next stripe, against the real tiles then
+	} else if (y < Height - 1) {
+		int d = Cell(x, y+1).TileID;
+		e += Tiles->EdgesMatchError(Tiles->EdgeDown(c),
+			Tiles->EdgeUp(d))*3;
+	} else {
+		int d = Cell(x, y-1).TileID;
+		e += Tiles->EdgesMatchError(Tiles->EdgeDown(c),
+			Tiles->VMirrorEdge(Tiles->EdgeDown(d)))*3; // Mirror
+	}
+	return e;
+}
+
+int Map::BestTile(unsigned int x, unsigned int y, unsigned int c0, unsigned char & best_tile) const {
+	const TileSet * Tiles = CurrentLayer->Tiles;
+	int best_err = -1;
+	best_tile = 0;
+	for (unsigned int ci = 0; ci < Tiles->NumTiles(); ++ci) {
+		int c = (c0+ci) % (Tiles->NumTiles()); // Current tile
+		int e = TileError(x, y, c);
+		if (best_err == -1 || e < best_err) {
+			best_tile = c;
+			best_err = e;
+		}
+	} // for (unsigned int ci = 0; ci < Tiles->NumTiles(); ++ci)
+	return best_err;
+}
+
+bool Map::AdjustTiles(unsigned int iterations, unsigned int y_begin, unsigned int y_end,
+		Clock::time_point deadline) {
+	const TileSet * Tiles = CurrentLayer->Tiles;
+	if (y_end > Height) y_end = Height;
+	unsigned int first_run = FirstActiveRun(y_begin);
+	unsigned int last_run = FirstActiveRun(y_end);
+	ForEachActiveRun([&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+		for (unsigned int x = x_begin; x < x_end; ++x) {
+			Cell(x, y).TileOK = true;
+		}
+	}, y_begin, y_end);
+	unsigned int wrong_resets = 0;
+
+	// The tiles of the sweep with the fewest wrong ones are kept aside, as
+	// the solver may be stopped right after a worse one, a reset, or halfway
+	// through a sweep. Until a sweep is done, those are the initial tiles.
+	bool anytime = deadline != Clock::time_point::max();
+	std::vector<unsigned char> best_tiles;
+	unsigned int best_wrong = UINT_MAX;
+	unsigned int last_wrong = UINT_MAX;
+	auto copy_tiles = [&](bool restore) {
+		size_t i = 0;
+		for (unsigned int r=first_run; r<last_run; ++r) {
+			unsigned int y = ActiveRuns[r].Y;
+			for (unsigned int x=ActiveRuns[r].XBegin; x<ActiveRuns[r].XEnd; ++x, ++i) {
+				if (restore) Cell(x, y).TileID = best_tiles[i];
+				else best_tiles[i] = Cell(x, y).TileID;
+			}
+		}
+	};
+	size_t num_cells = 0;
+	for (unsigned int r=first_run; r<last_run; ++r) {
+		num_cells += ActiveRuns[r].XEnd - ActiveRuns[r].XBegin;
+	}
+	best_tiles.resize(num_cells);
+	if (anytime) copy_tiles(false);
+
+	bool interrupted = false;
+	for (unsigned int k=0; k<iterations; ++k) {
+		if (anytime && Clock::now() >= deadline) {
+			printf("Out of time after %d iterations\n", k);
+			break;
+		}
+		if (Stopping) break;
+
+		// As if all the iterations were going to be needed
+		unsigned int rows_done = y_begin + (uint64_t)(y_end - y_begin) * k / iterations;
+		if (rows_done > StageRows) StageRows = rows_done;
+
+		std::atomic<unsigned int> changes(0);
+		std::atomic<unsigned int> wrong(0);
+		std::atomic<bool> out_of_time(false);
+		uint32_t seed = Rng();
+
+		// Cells of the same color in a checkerboard are never next to each
+		// other, so all of them can be adjusted at the same time. Each row of
+		// each block gets its own random numbers, so the result doesn't depend
+		// on the threads.
+		for (unsigned int color = 0; color < 2; ++color) {
+			ForEachActiveRun([&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+				// A sweep over a big stripe can take longer than its budget
+				if (out_of_time) return;
+				if ((anytime && Clock::now() >= deadline) || Stopping) {
+					out_of_time = true;
+					return;
+				}
+				unsigned int segment_changes = 0;
+				unsigned int segment_wrong = 0;
+				std::minstd_rand rng(seed ^ (((y * Width + x_begin) * 2 + color + 1) * 2654435761u));
+				unsigned int segment_width = x_end - x_begin;
+				unsigned int x0 = rng() % segment_width;
+				for (unsigned int xi=0; xi<segment_width; ++xi) {
+					unsigned int x = x_begin + (x0+xi) % segment_width;
+					if ((x + y) % 2 != color) continue;
+					if (!Cell(x, y).FixedTile && !Cell(x, y).Ignore) {
+						unsigned char best_tile;
+						int best_err = BestTile(x, y, rng() % (Tiles->NumTiles()), best_tile);
+
+						if (Cell(x, y).TileID != best_tile) ++segment_changes;
+						Cell(x, y).TileID = best_tile;
+						if (best_err) {
+							Cell(x, y).TileOK = false;
+							++segment_wrong;
+							if (rng() % 100 <= 5) {
+								ResetMapCell(x, y);
+							}
+						} else {
+							Cell(x, y).TileOK = true;
+						}
+					} // if (!Cell(x, y).FixedTile && !Cell(x, y).Ignore)
+				} // for (unsigned int xi=0; xi<segment_width; ++xi)
+				changes += segment_changes;
+				wrong += segment_wrong;
+			}, y_begin, y_end);
+		}
+		if (out_of_time) {
+			printf("Out of time during iteration %d\n", k);
+			interrupted = true;
+			break;
+		}
+		printf("Iter=%d, Changes= %d, Wrong=%d\n", k, changes.load(), wrong.load());
+		last_wrong = wrong;
+		if (wrong < best_wrong) {
+			best_wrong = wrong;
+			copy_tiles(false);
+		}
+		if (wrong && !changes) {
+			for (unsigned int r=first_run; r<last_run; ++r) {
+				unsigned int y = ActiveRuns[r].Y;
+				for (unsigned int x=ActiveRuns[r].XBegin; x<ActiveRuns[r].XEnd; ++x) {
+					if (!Cell(x, y).TileOK) {
+						ResetMapCell(x, y);
+						if (wrong_resets > 2) {
+							ResetMapCell(x-1, y);
+							ResetMapCell(x+1, y);
+							if (y > y_begin) ResetMapCell(x, y-1);
+							if (y + 1 < y_end) ResetMapCell(x, y+1);
+						}
+					}
+				}
+			}
+			++wrong_resets;
+			last_wrong = UINT_MAX; // Not counted again until the next sweep
+		}
+		if (!changes && !wrong) {
+			return true; // No wrong tiles
+		}
+	} // for (unsigned int k=0; k<iterations; ++k
+	bool saved = anytime || best_wrong != UINT_MAX;
+	if (interrupted ? saved : best_wrong < last_wrong) {
+		copy_tiles(true);
+	}
+	return false; // We still have wrong tiles, but we give up
+}
+
+// Threshold window around a cell, used as a key for the PatternCache
+uint32_t Map::PatternKey(unsigned int x, unsigned int y) const {
+	uint32_t key = 0;
+	for (int dy = -2; dy <= 2; ++dy) {
+		signed int cy = (signed int)y + dy;
+		if (cy < 0) cy = 0;
+		if (cy > (signed int)Height - 1) cy = Height - 1;
+		for (int dx = -2; dx <= 2; ++dx) {
+			if (!PatternCache::InWindow(dx, dy)) continue;
+			signed int cx = (signed int)x + dx;
+			if (cx < 0) cx = 0;
+			if (cx > (signed int)Width - 1) cx = Width - 1;
+			key = (key << 1) | (Cell(cx, cy).Elevation >= CurrentLayer->Elevation ? 1 : 0);
+		}
+	}
+	return key;
+}
+
+void Map::SetupInitialTiles(unsigned int y_begin, unsigned int y_end) {
+	const TileSet * Tiles = CurrentLayer->Tiles;
+	const PatternCache * Patterns = Tiles->GetPatternCache();
+	ForEachActiveRun([&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+		for (unsigned int x = x_begin; x < x_end; ++x) {
+			if (!Cell(x, y).FixedTile && !Cell(x, y).Ignore) {
+				Cell(x, y).LayerElevRef = CurrentLayer->Elevation;
+
+				if (Patterns) {
+					Cell(x, y).TileID = Patterns->Lookup(PatternKey(x, y));
+					continue;
+				}
+
+				unsigned int xm = x > 0        ? x - 1 : x;
+				unsigned int xp = x < Width-1  ? x + 1 : x;
+				unsigned int ym = y > 0        ? y - 1 : y;
+				unsigned int yp = y < Height-1 ? y + 1 : y;
+
+				bool c =  (Cell(x, y).Elevation >= CurrentLayer->Elevation);
+				bool l =  (Cell(xm, y).Elevation >= CurrentLayer->Elevation);
+				bool r =  (Cell(xp, y).Elevation >= CurrentLayer->Elevation);
+				bool u =  (Cell(x, yp).Elevation >= CurrentLayer->Elevation);
+				bool d =  (Cell(x, ym).Elevation >= CurrentLayer->Elevation);
+				bool ul = (Cell(xm, yp).Elevation >= CurrentLayer->Elevation);
+				bool ur = (Cell(xp, yp).Elevation >= CurrentLayer->Elevation);
+				bool dl = (Cell(xm, ym).Elevation >= CurrentLayer->Elevation);
+				bool dr = (Cell(xp, ym).Elevation >= CurrentLayer->Elevation);
+
+				if (!u && !d && !l && !r) c = false;
+				if (u && d && l && r) c = true;
+
+				Cell(x, y).TileID = Tiles->SolidTile();
+				//Cell(x, y).FixedTile = false;
+				//Cell(x, y).Ignore = false;
+
+				if (c & u & d & l & r) {
+					Cell(x, y).TileID = Tiles->SolidTile();
+					//if (ul & ur & dl & dr) {
+					//	Cell(x, y).FixedTile = true;
+					//}
+				} else if (!c & !u & !d & !l & !r) {
+					Cell(x, y).TileID = Tiles->EmptyTile();
+					//if (!ul & !ur & !dl & !dr) {
+					//	Cell(x, y).FixedTile = true;
+					//}
+				} else {
+					uint32_t env =
+						(ul?0x100:0)+( u?0x080:0)+(ur?0x040:0)+
+						( l?0x020:0)+( c?0x010:0)+( r?0x008:0)+
+						(dl?0x004:0)+( d?0x002:0)+(dr?0x001:0);
+					Cell(x, y).TileID = Tiles->InitialTileGuess(env);
+				}
+			} // if (!Cell(x, y).FixedTile && !Cell(x, y).Ignore)
+		} // for (unsigned int x = x_begin; x < x_end; ++x)
+	}, y_begin, y_end);
+}
+
+void Map::FindActiveRuns(unsigned int y_begin, unsigned int y_end) {
+	if (y_end > Height) y_end = Height;
+	ActiveRuns.clear();
+	if (y_end <= y_begin) return;
+
+	// Each band finds its own runs, which are then put together in order
+	const unsigned int band = 16;
+	unsigned int num_bands = (y_end - y_begin + band - 1) / band;
+	std::vector< std::vector<CellRun> > band_runs(num_bands);
+	Pool->ParallelFor(0, num_bands, 1, [&](unsigned int b_begin, unsigned int b_end) {
+		for (unsigned int b = b_begin; b < b_end; ++b) {
+			unsigned int band_begin = y_begin + b * band;
+			unsigned int band_end = band_begin + band < y_end ? band_begin + band : y_end;
+			std::vector<CellRun> & runs = band_runs[b];
+			for (unsigned int y = band_begin; y < band_end; ++y) {
+				for (unsigned int x_begin = 0; x_begin < Width; x_begin += BLOCK_SIZE) {
+					unsigned int x_end = x_begin + BLOCK_SIZE < Width ? x_begin + BLOCK_SIZE : Width;
+					unsigned int x = x_begin;
+					while (x < x_end) {
+						while (x < x_end && Cell(x, y).Ignore) ++x;
+						if (x == x_end) break;
+						CellRun run;
+						run.Y = y;
+						run.XBegin = x;
+						while (x < x_end && !Cell(x, y).Ignore) ++x;
+						run.XEnd = x;
+						runs.push_back(run);
+					}
+				}
+			}
+		}
+	});
+
+	for (unsigned int b = 0; b < num_bands; ++b) {
+		ActiveRuns.insert(ActiveRuns.end(), band_runs[b].begin(), band_runs[b].end());
+	}
+}
+
+unsigned int Map::CountConflicts(unsigned int y_begin, unsigned int y_end) {
+	std::atomic<unsigned int> conflicts(0);
+	ForEachActiveRun([&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+		unsigned int segment_conflicts = 0;
+		for (unsigned int x = x_begin; x < x_end; ++x) {
+			if (TileError(x, y, Cell(x, y).TileID)) ++segment_conflicts;
+		}
+		conflicts += segment_conflicts;
+	}, y_begin, y_end);
+	return conflicts;
+}
+
+// Each wrong tile, and then its neighbours, get the tile that best matches
+// what is around them. Much cheaper than a sweep, as most tiles are right.
+void Map::PatchUpTiles(unsigned int y_begin, unsigned int y_end) {
+	std::vector<CellRun> wrong;
+	std::mutex wrong_lock;
+	ForEachActiveRun([&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+		std::vector<CellRun> segment_wrong;
+		for (unsigned int x = x_begin; x < x_end; ++x) {
+			if (!Cell(x, y).FixedTile && TileError(x, y, Cell(x, y).TileID)) {
+				CellRun cell = { y, x, x + 1 };
+				segment_wrong.push_back(cell);
+			}
+		}
+		if (!segment_wrong.empty()) {
+			std::lock_guard<std::mutex> lock(wrong_lock);
+			wrong.insert(wrong.end(), segment_wrong.begin(), segment_wrong.end());
+		}
+	}, y_begin, y_end);
+
+	// Always in the same order, whatever the threads did
+	std::sort(wrong.begin(), wrong.end(), [](const CellRun & a, const CellRun & b) {
+		return a.Y < b.Y || (a.Y == b.Y && a.XBegin < b.XBegin);
+	});
+
+	auto patch = [&](unsigned int x, unsigned int y) {
+		if (x >= Width || y < y_begin || y >= y_end) return;
+		if (Cell(x, y).FixedTile || Cell(x, y).Ignore) return;
+		unsigned char best_tile;
+		BestTile(x, y, 0, best_tile);
+		Cell(x, y).TileID = best_tile;
+	};
+
+	for (unsigned int pass = 0; pass < 2; ++pass) {
+		for (unsigned int i = 0; i < wrong.size(); ++i) {
+			unsigned int x = wrong[i].XBegin;
+			unsigned int y = wrong[i].Y;
+			patch(x, y);
+			if (!TileError(x, y, Cell(x, y).TileID)) continue;
+			patch(x-1, y);
+			patch(x+1, y);
+			patch(x, y-1);
+			patch(x, y+1);
+			patch(x, y);
+		}
+	}
+}
+
+// Deadline for the next of parts_left equal shares of the time left
+static Map::Clock::time_point ShareOf(Map::Clock::time_point deadline, unsigned int parts_left) {
+	if (deadline == Map::Clock::time_point::max()) return deadline;
+	Map::Clock::time_point now = Map::Clock::now();
+	if (now >= deadline || parts_left <= 1) return deadline;
+	return now + (deadline - now) / parts_left;
+}
+
+// Solved one stripe after the other. Each stripe goes back over the last rows
+// of the previous one, so that the seam between them can still be fixed, and
+// starts from the initial guess of the row right below it. The cells of each
+// stripe are only prepared for the layer right before it is solved, so that a
+// mapped map has only a few stripes in use at any time. The time left is
+// shared out evenly between the stripes that are still to be solved.
+unsigned int Map::SolveCurrentLayer(const SegmentTask & prepare, const SegmentTask & finish,
+		Clock::time_point deadline) {
+	if (LayerBudget) {
+		Clock::time_point layer_deadline = Clock::now() + std::chrono::milliseconds(LayerBudget);
+		if (layer_deadline < deadline) deadline = layer_deadline;
+	}
+
+	if (Writer && !Writer->BeginLayer(CurrentLayer - (Layers + 1))) {
+		printf("Unable to export the map, giving up\n");
+		Writer = NULL;
+	}
+
+	unsigned int stripe = StripeRows && StripeRows < Height ? StripeRows : Height;
+	unsigned int prepared = 0;
+	unsigned int finished = 0;
+	unsigned int counted = 0;
+	unsigned int conflicts = 0;
+	for (unsigned int y0 = 0; y0 < Height; y0 += stripe) {
+		unsigned int y1 = y0 + stripe < Height ? y0 + stripe : Height;
+		unsigned int adjust_begin = y0 > STRIPE_OVERLAP ? y0 - STRIPE_OVERLAP : 0;
+		unsigned int setup_end = y1 < Height ? y1 + 1 : Height;
+		Clock::time_point stripe_deadline = ShareOf(deadline, (Height - y0 + stripe - 1) / stripe);
+
+		ForEachSegment(prepare, prepared, setup_end);
+		prepared = setup_end;
+
+		// The row above is only needed to count its conflicts
+		FindActiveRuns(adjust_begin > 0 ? adjust_begin - 1 : 0, setup_end);
+		OpenRow = y1 < Height ? y1 : UINT_MAX;
+		for (unsigned int tries = 0 ; tries < 2; ++tries) {
+			SetupInitialTiles(tries ? adjust_begin : y0, setup_end);
+			if (AdjustTiles(300, adjust_begin, y1, stripe_deadline)) break;
+			if (Clock::now() >= stripe_deadline || Stopping) break;
+		}
+		if (PatchUp) PatchUpTiles(adjust_begin, y1);
+		OpenRow = UINT_MAX;
+
+		// The next stripe won't go back over the rows before its own overlap,
+		// and the last of them still depends on the row right after it.
+		unsigned int final_end = y1 == Height ? Height : (y1 > STRIPE_OVERLAP ? y1 - STRIPE_OVERLAP : 0);
+		{
+			std::lock_guard<std::mutex> lock(DisplayLock);
+			ForEachActiveRun(finish, finished, final_end);
+		}
+		ExportRows(finished, final_end);
+		if (final_end > ReadyRows) ReadyRows = final_end;
+		if (final_end > StageRows) StageRows = final_end;
+		finished = final_end;
+		unsigned int count_end = final_end == Height || final_end == 0 ? final_end : final_end - 1;
+		conflicts += CountConflicts(counted, count_end);
+		counted = count_end;
+	}
+	ActiveRuns.clear();
+	ActiveRuns.shrink_to_fit();
+	if (Writer && !Writer->EndLayer()) {
+		printf("Unable to export the map, giving up\n");
+		Writer = NULL;
+	}
+
+	printf("Layer %d: %u wrong tiles left\n", CurrentLayer->Elevation, conflicts);
+	return conflicts;
+}
+
+void Map::Random(uint32_t seed, const RowsTask & done) {
+	{
+		std::lock_guard<std::mutex> lock(DisplayLock);
+		ReadyRows = 0;
+	}
+	Stage = 0;
+	StageRows = 0;
+	Seed = seed;
+	Rng.seed(seed);
+
+	// Each row gets its own random numbers, like in AdjustTiles. Each row is
+	// written only once, so that a mapped map is written to only once.
+	Pool->ParallelFor(0, Height, 16, [&](unsigned int y_begin, unsigned int y_end) {
+		for (unsigned int y = y_begin; y < y_end; ++y) {
+			std::minstd_rand rng(seed ^ ((y + 1) * 2654435761u));
+			for (unsigned int x=0; x<Width; ++x) {
+				memset(&Cell(x, y), 0, sizeof(MapCell));
+				Cell(x, y).Elevation = MinElevation + (rng() % (MaxElevation - MinElevation));
+				Cell(x, y).FixedTile = false;
+			}
+		}
+	});
+
+	GaussianBlur(5, done);
+}
+
+void Map::Random(const RowsTask & done) {
+	Random(rand(), done);
+
+	if (StripeRows) return; // Far too big to be printed
+
+	for(unsigned int y = 0; y < Height; ++y) {
+		for(unsigned int x = 0; x < Width; ++x) {
+			printf("%3d ", Cell(x, y).Elevation);
+		}
+		printf("\n");
+	}
+	printf("\n");
+}
+
+bool Map::Import(HeightmapReader & heightmap, const RowsTask & done) {
+	if (heightmap.Width() != Width || heightmap.Height() != Height) {
+		printf("The heightmap is %ux%u, and the map %ux%u\n", heightmap.Width(), heightmap.Height(), Width, Height);
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(DisplayLock);
+		ReadyRows = 0;
+	}
+	Stage = 0;
+	StageRows = 0;
+	Seed = 0;
+	Rng.seed(Seed);
+
+	std::vector<signed int> row(Width);
+	for (unsigned int y = 0; y < Height; ++y) {
+		if (Stopping) return false;
+		if (!heightmap.ReadRow(&row[0], MinElevation, MaxElevation)) {
+			printf("Unable to read the row %u of the heightmap\n", y);
+			return false;
+		}
+		for (unsigned int x = 0; x < Width; ++x) {
+			memset(&Cell(x, y), 0, sizeof(MapCell));
+			Cell(x, y).Elevation = row[x];
+			Cell(x, y).FixedTile = false;
+		}
+		StageRows = y + 1;
+		if (done) done(y, y + 1);
+	}
+	return true;
+}
+
+void Map::ExportRows(unsigned int y_begin, unsigned int y_end)
+{
+	if (!Writer) return;
+
+	int * row = new int[Width];
+	bool ok = true;
+	for(unsigned int y = y_begin; ok && y < y_end; ++y) {
+		for(unsigned int x = 0; x < Width; ++x) {
+			row[x] = Cell(x, y).Ignore ? (int)IMapWriter::NO_TILE : Cell(x, y).TileID;
+		}
+		ok = Writer->WriteRow(row);
+	}
+	delete[] row;
+
+	if (!ok) {
+		printf("Unable to export the map, giving up\n");
+		Writer = NULL;
+	}
+}
+
+unsigned int Map::AddTiles()
+{
+	if (Writer) {
+		unsigned int num_layers = 0;
+		while (Layers[num_layers + 1].Tiles != NULL) ++num_layers;
+		if (!Writer->BeginMap(Width, Height, Layers + 1, num_layers)) {
+			printf("Unable to export the map, giving up\n");
+			Writer = NULL;
+		}
+	}
+
+	// Whatever is left of the overall budget is shared out between the layers
+	Clock::time_point deadline = Clock::time_point::max();
+	if (TotalBudget) deadline = Clock::now() + std::chrono::milliseconds(TotalBudget);
+	unsigned int layers_left = 1 + (StartingLayer[1].Tiles ? 1 : 0) + (StartingLayer[-1].Tiles ? 1 : 0);
+	unsigned int conflicts = 0;
+
+	// Central layer
+	CurrentLayer = StartingLayer;
+	Stage = 1;
+	StageRows = 0;
+	TileSet * tiles = CurrentLayer->Tiles;
+	unsigned int empty_tile = tiles->EmptyTile();
+	unsigned int solid_tile = tiles->SolidTile();
+
+	conflicts += SolveCurrentLayer([&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+		for (unsigned int x = x_begin; x < x_end; ++x) {
+			Cell(x, y).FixedTile = false;
+			Cell(x, y).Ignore = false;
+			Cell(x, y).TileRuntimeData = &tiles->GetTileRuntimeData(empty_tile);
+		}
+	}, [&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+		for (unsigned int x = x_begin; x < x_end; ++x) {
+			unsigned int tile_id = Cell(x, y).TileID;
+			Cell(x, y).TileRuntimeData = &tiles->GetTileRuntimeData(tile_id);
+			if (tile_id == solid_tile) Cell(x, y).GrowUp = true;
+			else if (tile_id == empty_tile) Cell(x, y).GrowDown = true;
+		}
+	}, ShareOf(deadline, layers_left--));
+
+	// Upper layer
+	CurrentLayer = StartingLayer + 1;
+	tiles = CurrentLayer->Tiles;
+	if (tiles != NULL) {
+		++Stage;
+		StageRows = 0;
+		empty_tile = tiles->EmptyTile();
+		solid_tile = tiles->SolidTile();
+
+		// Only the cells that grow into this layer take part in it
+		conflicts += SolveCurrentLayer([&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+			for (unsigned int x = x_begin; x < x_end; ++x) {
+				if (!Cell(x, y).FixedTile) {
+					Cell(x, y).TileID = empty_tile;
+					if (Cell(x, y).GrowUp) {
+						Cell(x, y).Ignore = false;
+					} else {
+						Cell(x, y).Ignore = true;
+					}
+				}
+			}
+		}, [&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+			for (unsigned int x = x_begin; x < x_end; ++x) {
+				if (Cell(x, y).GrowUp) {
+					unsigned int tile_id = Cell(x, y).TileID;
+					Cell(x, y).TileRuntimeData = &tiles->GetTileRuntimeData(tile_id);
+					if (tile_id == solid_tile) Cell(x, y).GrowUp = true;
+					else if (tile_id == empty_tile) Cell(x, y).GrowUp = false;
+				}
+			}
+		}, ShareOf(deadline, layers_left--));
+	}
+
+	// Lower layer
+	CurrentLayer = StartingLayer - 1;
+	tiles = CurrentLayer->Tiles;
+	if (tiles != NULL) {
+		++Stage;
+		StageRows = 0;
+		empty_tile = tiles->EmptyTile();
+		solid_tile = tiles->SolidTile();
+
+		// Only the cells that grow into this layer take part in it
+		conflicts += SolveCurrentLayer([&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+			for (unsigned int x = x_begin; x < x_end; ++x) {
+				if (!Cell(x, y).FixedTile) {
+					Cell(x, y).TileID = solid_tile;
+					if (Cell(x, y).GrowDown) {
+						Cell(x, y).Ignore = false;
+					} else {
+						Cell(x, y).Ignore = true;
+					}
+				}
+			}
+		}, [&](unsigned int y, unsigned int x_begin, unsigned int x_end) {
+			for (unsigned int x = x_begin; x < x_end; ++x) {
+				if (Cell(x, y).GrowDown) {
+					unsigned int tile_id = Cell(x, y).TileID;
+					Cell(x, y).TileRuntimeData = &tiles->GetTileRuntimeData(tile_id);
+					if (tile_id == solid_tile) Cell(x, y).GrowUp = true;
+					else if (tile_id == empty_tile) Cell(x, y).GrowUp = false;
+				}
+			}
+		}, ShareOf(deadline, layers_left--));
+	}
+
+	if (Writer && !Writer->EndMap()) {
+		printf("Unable to export the map\n");
+	}
+	++Stage;
+	StageRows = 0;
+	return conflicts;
+}
+
+float Map::Progress() const {
+	if (!StartingLayer) return 0;
+	unsigned int stages = 2 + (StartingLayer[1].Tiles ? 1 : 0) + (StartingLayer[-1].Tiles ? 1 : 0);
+	unsigned int stage = Stage;
+	if (stage >= stages) return 1;
+	return (stage + (float)StageRows / Height) / stages;
+}
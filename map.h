@@ -0,0 +1,308 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MAP_H_3A9E7D14_4D7B_11E3_A1F6_525400DA3F0D
+#define MAP_H_3A9E7D14_4D7B_11E3_A1F6_525400DA3F0D
+
+#include "tileset.h"
+#include "mapwriter.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <vector>
+
+class HeightmapReader;
+
+#define VERY_HIGH INT_MAX
+#define VERY_LOW INT_MIN
+
+struct MapCell {
+	signed int Elevation;
+	signed int LayerElevRef;
+	TileSet::TileRuntime * TileRuntimeData;
+	unsigned char TileID;
+	struct {
+		bool FixedTile : 1;
+		bool Ignore : 1;
+		bool GrowUp : 1;
+		bool GrowDown : 1;
+		bool TileOK : 1; // Matched its neighbours the last time it was adjusted
+	};
+};
+
+// Cells [XBegin, XEnd) of the row Y, never crossing a block
+struct CellRun {
+	unsigned int Y;
+	unsigned int XBegin;
+	unsigned int XEnd;
+};
+
+struct MapLayer {
+	TileSet * Tiles;
+	signed int Elevation;
+};
+
+struct Map {
+	enum CellLayout {
+		LAYOUT_ROWS,   // Plain row-major array
+		LAYOUT_BLOCKS, // Row-major array of BLOCK_SIZE x BLOCK_SIZE blocks
+	};
+
+	enum {
+		BLOCK_SHIFT = 6,
+		BLOCK_SIZE = 1 << BLOCK_SHIFT,
+		BLOCK_MASK = BLOCK_SIZE - 1,
+	};
+
+	typedef std::function<void(unsigned int y, unsigned int x_begin, unsigned int x_end)> SegmentTask;
+	typedef std::function<void(unsigned int y_begin, unsigned int y_end)> RowsTask;
+	typedef std::chrono::steady_clock Clock;
+
+	enum {
+		STRIPE_OVERLAP = 8, // Rows of the previous stripe that are solved again
+	};
+
+	// With a backing file, the cells are memory-mapped from it instead of
+	// being allocated, so that the map can be bigger than the memory.
+	Map(unsigned int w, unsigned int h, signed int min_elev, signed int max_elev,
+		CellLayout layout = LAYOUT_ROWS, const char * backing_file = NULL);
+	~Map();
+
+	inline unsigned int getWidth() { return Width; }
+	inline unsigned int getHeight() { return Height; }
+
+	inline size_t CellIndex(unsigned int x, unsigned int y) const {
+		if (Layout == LAYOUT_ROWS) return x + (size_t)y*Width;
+		size_t block = (size_t)(y >> BLOCK_SHIFT) * BlocksX + (x >> BLOCK_SHIFT);
+		return (block << (2*BLOCK_SHIFT)) + ((y & BLOCK_MASK) << BLOCK_SHIFT) + (x & BLOCK_MASK);
+	}
+
+	inline MapCell & Cell(unsigned int x, unsigned int y) {
+		return Cells[CellIndex(x, y)];
+	}
+
+	inline const MapCell & Cell(unsigned int x, unsigned int y) const {
+		return Cells[CellIndex(x, y)];
+	}
+
+	// Calls segment(y, x_begin, x_end) for every row of every block, in
+	// parallel for each band of rows and block after block inside each band,
+	// so that the rows above and below are still in cache when they are read.
+	// Only the rows in [rows_begin, rows_end) are visited.
+	template <class Segment> void ForEachSegment(const Segment & segment,
+			unsigned int rows_begin = 0, unsigned int rows_end = UINT_MAX) {
+		if (rows_end > Height) rows_end = Height;
+		if (rows_end <= rows_begin) return;
+		unsigned int band = Layout == LAYOUT_BLOCKS ? BLOCK_SIZE : 16;
+		unsigned int num_bands = (rows_end - rows_begin + band - 1) / band;
+		Pool->ParallelFor(0, num_bands, 1, [&](unsigned int b_begin, unsigned int b_end) {
+			for (unsigned int b = b_begin; b < b_end; ++b) {
+				unsigned int y_begin = rows_begin + b * band;
+				unsigned int y_end = y_begin + band < rows_end ? y_begin + band : rows_end;
+				for (unsigned int x_begin = 0; x_begin < Width; x_begin += BLOCK_SIZE) {
+					unsigned int x_end = x_begin + BLOCK_SIZE < Width ? x_begin + BLOCK_SIZE : Width;
+					for (unsigned int y = y_begin; y < y_end; ++y) {
+						segment(y, x_begin, x_end);
+					}
+				}
+			}
+		});
+	}
+
+	// Finds the cells of the rows [y_begin, y_end) that the current layer
+	// doesn't ignore, so that solving it doesn't have to go over the rest.
+	void FindActiveRuns(unsigned int y_begin, unsigned int y_end);
+
+	// Like ForEachSegment, but only over the active runs in [rows_begin, rows_end)
+	template <class Segment> void ForEachActiveRun(const Segment & segment,
+			unsigned int rows_begin = 0, unsigned int rows_end = UINT_MAX) {
+		unsigned int first = FirstActiveRun(rows_begin);
+		unsigned int last = FirstActiveRun(rows_end);
+		Pool->ParallelFor(first, last, 16, [&](unsigned int r_begin, unsigned int r_end) {
+			for (unsigned int r = r_begin; r < r_end; ++r) {
+				segment(ActiveRuns[r].Y, ActiveRuns[r].XBegin, ActiveRuns[r].XEnd);
+			}
+		});
+	}
+
+	// Index of the first active run at or below the row y
+	inline unsigned int FirstActiveRun(unsigned int y) const {
+		return std::lower_bound(ActiveRuns.begin(), ActiveRuns.end(), y,
+			[](const CellRun & run, unsigned int row) { return run.Y < row; }) - ActiveRuns.begin();
+	}
+
+	void GaussianBlur(float radius, const RowsTask & done = RowsTask());
+	void ResetMapCell(unsigned int x, unsigned int y);
+
+	// How badly the tile c would match the neighbours of the cell. The tiles
+	// of OpenRow aren't solved yet, so the ones above them aren't held to them.
+	int TileError(unsigned int x, unsigned int y, unsigned int c) const;
+
+	// Tile that best matches the neighbours, trying them from c0 onwards
+	int BestTile(unsigned int x, unsigned int y, unsigned int c0, unsigned char & best_tile) const;
+
+	// Only the active runs in [y_begin, y_end) are changed; the rows right
+	// above and below them are read as they are. Once the deadline or the
+	// last iteration is reached, the best tiles found so far are kept.
+	bool AdjustTiles(unsigned int iterations = 300,
+		unsigned int y_begin = 0, unsigned int y_end = UINT_MAX,
+		Clock::time_point deadline = Clock::time_point::max());
+
+	// Active cells in [y_begin, y_end) that don't match their neighbours
+	unsigned int CountConflicts(unsigned int y_begin, unsigned int y_end);
+
+	// Quick local fix of the wrong tiles left in [y_begin, y_end)
+	void PatchUpTiles(unsigned int y_begin, unsigned int y_end);
+
+	// Threshold window around a cell, used as a key for the PatternCache
+	uint32_t PatternKey(unsigned int x, unsigned int y) const;
+
+	void SetupInitialTiles(unsigned int y_begin = 0, unsigned int y_end = UINT_MAX);
+	// Calls prepare on the rows of the current layer right before they are
+	// first needed, sets up and adjusts its active cells, and calls finish on
+	// each active run once its tiles are final, then exports those rows.
+	// Returns how many wrong tiles are left.
+	unsigned int SolveCurrentLayer(const SegmentTask & prepare, const SegmentTask & finish,
+		Clock::time_point deadline = Clock::time_point::max());
+	// Random elevation from a seed of its own, blurred. The same seed gives
+	// the same map, tiles included, whatever the threads and the layout of
+	// the cells. The stripes only keep the elevation the same: the solver
+	// draws its seeds stripe after stripe, so other stripes give other tiles.
+	// done is called on the rows, in order, as soon as their elevation is
+	// final, so that they can be measured while they are still in memory.
+	void Random(uint32_t seed, const RowsTask & done = RowsTask());
+	void Random(const RowsTask & done = RowsTask());
+
+	// Elevation from a heightmap instead, rescaled into [MinElevation,
+	// MaxElevation] and not blurred. The map has to be created with the size
+	// of the heightmap, or nothing is read. It's read one row at a time, so
+	// that only the cells, which can be mapped, hold all of it. Returns false
+	// if it can't be read, or the map is stopped before it's done. done is
+	// called on each row, like with Random.
+	bool Import(HeightmapReader & heightmap, const RowsTask & done = RowsTask());
+
+	inline uint32_t GetSeed() const {
+		return Seed;
+	}
+
+	// Returns how many wrong tiles are left in all the layers
+	unsigned int AddTiles();
+
+	// Generates, blurs and solves the map in stripes of that many rows, 0 for
+	// the whole map at once. Each stripe only reads a few rows of the ones
+	// next to it, so only a few stripes are in use at any time. Each stripe
+	// is solved as if it ended the map, and its last STRIPE_OVERLAP rows are
+	// solved again with the next one. The tiles aren't the ones of the whole
+	// map, but about as many are wrong, and small stripes solve them again
+	// more often.
+	inline void SetStripeRows(unsigned int rows) {
+		StripeRows = rows;
+	}
+
+	// Time for solving each layer and the whole map, in milliseconds, or 0 for
+	// no limit. The solver stops when it runs out of time, wrong tiles or not.
+	inline void SetTimeBudget(unsigned int layer_ms, unsigned int total_ms) {
+		LayerBudget = layer_ms;
+		TotalBudget = total_ms;
+	}
+
+	// How far Random and AddTiles have got, from 0 to 1
+	float Progress() const;
+
+	// Makes the solver give up as soon as it can, for when the map is
+	// generated in another thread that has to be stopped
+	inline void Stop() {
+		Stopping = true;
+	}
+
+	// Whether the wrong tiles left by the solver get a quick local fix
+	inline void SetPatchUp(bool patch_up) {
+		PatchUp = patch_up;
+	}
+
+	inline void SetLayers(MapLayer layers[]) {
+		Layers = layers;
+		StartingLayer = &Layers[0];
+	}
+
+	inline void SetStartingLayer(int index) {
+		StartingLayer = &Layers[index];
+	}
+
+	inline MapLayer * GetCurrentLayer() {
+		return CurrentLayer;
+	}
+
+	// The rows of each layer are streamed to the writer as soon as AddTiles
+	// has made them final, stripe after stripe
+	inline void SetWriter(IMapWriter * writer) {
+		Writer = writer;
+	}
+
+	// Writes the rows [y_begin, y_end) of the current layer, between the
+	// BeginLayer and EndLayer of the writer
+	void ExportRows(unsigned int y_begin, unsigned int y_end);
+
+	unsigned int Width;
+	unsigned int Height;
+	CellLayout Layout;
+	unsigned int BlocksX;
+	size_t NumCells;
+	unsigned int StripeRows;
+	unsigned int OpenRow;      // Row below the stripe being solved, UINT_MAX if none
+	unsigned int LayerBudget;
+	unsigned int TotalBudget;
+	bool PatchUp;
+	MapLayer * Layers;
+	MapLayer * StartingLayer;
+	MapLayer * CurrentLayer;
+	IMapWriter * Writer;
+	ThreadPool * Pool;
+	MapCell *Cells;
+	bool CellsMapped;
+	std::vector<CellRun> ActiveRuns;
+
+	// The map can be shown while it is being generated, in another thread.
+	// The tiles of the rows before ReadyRows can be drawn while holding
+	// DisplayLock, which the generator holds whenever it changes them.
+	std::mutex DisplayLock;
+	std::atomic<unsigned int> ReadyRows;
+	std::atomic<unsigned int> Stage;     // 0 for the elevation, then each layer
+	std::atomic<unsigned int> StageRows; // Rows of the current stage done, more or less
+	std::atomic<bool> Stopping;
+	signed int MaxElevation;
+	signed int MinElevation;
+	uint32_t Seed;
+	std::minstd_rand Rng; // Seeds of the solver iterations
+};
+
+#endif // MAP_H_3A9E7D14_4D7B_11E3_A1F6_525400DA3F0D
@@ -0,0 +1,298 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "mapwriter.h"
+#include "map.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <string>
+
+// Big enough to let the disk, and not the writes, set the pace
+static const size_t FileBufferSize = 1 << 20;
+
+// Every number of a row is formatted by hand into a single buffer that gets
+// written at once; printf would be the bottleneck on large maps.
+static inline char * FormatInt(char * out, int value) {
+	char digits[12];
+	unsigned int n = 0;
+	unsigned int v = value < 0 ? -value : value;
+	if (value < 0) *out++ = '-';
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (n) *out++ = digits[--n];
+	return out;
+}
+
+static const char Base64Chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static inline char * Base64Triple(char * out, const unsigned char * in) {
+	*out++ = Base64Chars[in[0] >> 2];
+	*out++ = Base64Chars[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+	*out++ = Base64Chars[((in[1] & 0x0F) << 2) | (in[2] >> 6)];
+	*out++ = Base64Chars[in[2] & 0x3F];
+	return out;
+}
+
+// Path of the directory to, as seen from the directory from. Both are made
+// absolute first; if either can't be, to is returned as it is.
+static std::string RelativePath(const char * from, const char * to) {
+	char from_path[PATH_MAX];
+	char to_path[PATH_MAX];
+	if (!realpath(from, from_path) || !realpath(to, to_path)) return to;
+
+	// Components in common, then up from what's left of from, and down to to
+	size_t common = 0;
+	for (size_t i = 0; ; ++i) {
+		bool from_end = from_path[i] == '\0' || from_path[i] == '/';
+		bool to_end = to_path[i] == '\0' || to_path[i] == '/';
+		if (from_end && to_end) common = i;
+		if (from_path[i] != to_path[i] || from_path[i] == '\0') break;
+	}
+	std::string path;
+	for (const char * c = from_path + common; *c; ++c) {
+		if (*c == '/') path += "../";
+	}
+	const char * rest = to_path + common;
+	if (*rest == '/') ++rest;
+	path += rest;
+	if (path.empty()) path = ".";
+	else if (path[path.size() - 1] == '/') path.erase(path.size() - 1);
+	return path;
+}
+
+TmxWriter::TmxWriter(const char * filename, Encoding encoding,
+		unsigned int tile_width, unsigned int tile_height) :
+		FileName(filename),
+		File(NULL),
+		DataEncoding(encoding),
+		TileWidth(tile_width),
+		TileHeight(tile_height),
+		Width(0),
+		Height(0),
+		Layers(NULL),
+		FirstGid(NULL),
+		CurrentLayer(0),
+		CurrentRow(0),
+		RowText(NULL),
+		RowData(NULL),
+		PendingBytes(0) {
+}
+
+TmxWriter::~TmxWriter() {
+	if (File) fclose(File);
+	delete[] FirstGid;
+	delete[] RowText;
+	delete[] RowData;
+}
+
+bool TmxWriter::BeginMap(unsigned int width, unsigned int height,
+		const MapLayer * layers, unsigned int num_layers) {
+	File = fopen(FileName, "w");
+	if (!File) return false;
+	setvbuf(File, NULL, _IOFBF, FileBufferSize);
+
+	Width = width;
+	Height = height;
+	Layers = layers;
+	RowText = new char[Width * 12 + 16];
+	RowData = new unsigned char[Width * 4];
+
+	fprintf(File, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	fprintf(File, "<map version=\"1.10\" orientation=\"orthogonal\" renderorder=\"right-down\""
+		" width=\"%u\" height=\"%u\" tilewidth=\"%u\" tileheight=\"%u\" infinite=\"0\""
+		" nextlayerid=\"%u\" nextobjectid=\"1\">\n",
+		Width, Height, TileWidth, TileHeight, num_layers + 1);
+
+	// Tiled looks for the images next to the map file, not in the current directory
+	std::string map_dir = FileName;
+	size_t slash = map_dir.rfind('/');
+	map_dir = slash == std::string::npos ? "." : slash == 0 ? "/" : map_dir.substr(0, slash);
+
+	// Global tile ids start at 1, 0 means there is no tile
+	FirstGid = new unsigned int[num_layers];
+	unsigned int gid = 1;
+	for (unsigned int i = 0; i < num_layers; ++i) {
+		const TileSet * tiles = Layers[i].Tiles;
+		FirstGid[i] = gid;
+		fprintf(File, " <tileset firstgid=\"%u\" name=\"%s\" tilewidth=\"%u\" tileheight=\"%u\""
+			" tilecount=\"%u\" columns=\"0\">\n",
+			gid, tiles->BaseDirectory(), TileWidth, TileHeight, tiles->NumTiles());
+		fprintf(File, "  <grid orientation=\"orthogonal\" width=\"1\" height=\"1\"/>\n");
+		std::string image_dir = RelativePath(map_dir.c_str(), tiles->BaseDirectory());
+		for (unsigned int t = 0; t < tiles->NumTiles(); ++t) {
+			fprintf(File, "  <tile id=\"%u\">\n", t);
+			fprintf(File, "   <image width=\"%u\" height=\"%u\" source=\"%s/%s\"/>\n",
+				TileWidth, TileHeight, image_dir.c_str(), tiles->BaseFileName(t));
+			fprintf(File, "  </tile>\n");
+		}
+		fprintf(File, " </tileset>\n");
+		gid += tiles->NumTiles();
+	}
+	return !ferror(File);
+}
+
+bool TmxWriter::BeginLayer(unsigned int layer) {
+	CurrentLayer = layer;
+	CurrentRow = 0;
+	PendingBytes = 0;
+	fprintf(File, " <layer id=\"%u\" name=\"Elevation %d\" width=\"%u\" height=\"%u\">\n",
+		layer + 1, Layers[layer].Elevation, Width, Height);
+	if (DataEncoding == ENCODING_CSV) {
+		fprintf(File, "  <data encoding=\"csv\">\n");
+	} else {
+		fprintf(File, "  <data encoding=\"base64\">\n   ");
+	}
+	return !ferror(File);
+}
+
+void TmxWriter::Base64(const unsigned char * data, unsigned int size, char * & out) {
+	// Bytes left over from the previous row come first
+	while (PendingBytes && size) {
+		Pending[PendingBytes++] = *data++;
+		--size;
+		if (PendingBytes == 3) {
+			out = Base64Triple(out, Pending);
+			PendingBytes = 0;
+		}
+	}
+	while (size >= 3) {
+		out = Base64Triple(out, data);
+		data += 3;
+		size -= 3;
+	}
+	while (size--) {
+		Pending[PendingBytes++] = *data++;
+	}
+}
+
+bool TmxWriter::WriteRow(const int * tiles) {
+	char * out = RowText;
+	unsigned int first_gid = FirstGid[CurrentLayer];
+	++CurrentRow;
+
+	if (DataEncoding == ENCODING_CSV) {
+		for (unsigned int x = 0; x < Width; ++x) {
+			if (x) *out++ = ',';
+			out = FormatInt(out, tiles[x] == NO_TILE ? 0 : tiles[x] + first_gid);
+		}
+		if (CurrentRow < Height) *out++ = ',';
+		*out++ = '\n';
+	} else {
+		// Little endian 32 bit global tile ids
+		unsigned char * data = RowData;
+		for (unsigned int x = 0; x < Width; ++x) {
+			uint32_t gid = tiles[x] == NO_TILE ? 0 : tiles[x] + first_gid;
+			*data++ = gid & 0xFF;
+			*data++ = (gid >> 8) & 0xFF;
+			*data++ = (gid >> 16) & 0xFF;
+			*data++ = (gid >> 24) & 0xFF;
+		}
+		Base64(RowData, Width * 4, out);
+	}
+
+	return fwrite(RowText, out - RowText, 1, File) == 1 || out == RowText;
+}
+
+bool TmxWriter::EndLayer() {
+	if (DataEncoding == ENCODING_BASE64) {
+		if (PendingBytes) {
+			char out[4];
+			unsigned int n = PendingBytes;
+			memset(Pending + n, 0, 3 - n);
+			Base64Triple(out, Pending);
+			if (n < 2) out[2] = '=';
+			out[3] = '=';
+			fwrite(out, sizeof(out), 1, File);
+			PendingBytes = 0;
+		}
+		fprintf(File, "\n");
+	}
+	fprintf(File, "  </data>\n");
+	fprintf(File, " </layer>\n");
+	return !ferror(File);
+}
+
+bool TmxWriter::EndMap() {
+	fprintf(File, "</map>\n");
+	bool ok = !ferror(File);
+	ok = fclose(File) == 0 && ok;
+	File = NULL;
+	return ok;
+}
+
+CsvWriter::CsvWriter(const char * prefix) :
+		Prefix(prefix),
+		File(NULL),
+		Width(0),
+		RowText(NULL) {
+}
+
+CsvWriter::~CsvWriter() {
+	if (File) fclose(File);
+	delete[] RowText;
+}
+
+bool CsvWriter::BeginMap(unsigned int width, unsigned int,
+		const MapLayer *, unsigned int) {
+	Width = width;
+	RowText = new char[Width * 12 + 2];
+	return true;
+}
+
+bool CsvWriter::BeginLayer(unsigned int layer) {
+	char filename[256];
+	snprintf(filename, sizeof(filename), "%s%u.csv", Prefix, layer);
+	File = fopen(filename, "w");
+	if (!File) return false;
+	setvbuf(File, NULL, _IOFBF, FileBufferSize);
+	return true;
+}
+
+bool CsvWriter::WriteRow(const int * tiles) {
+	char * out = RowText;
+	for (unsigned int x = 0; x < Width; ++x) {
+		if (x) *out++ = ',';
+		out = FormatInt(out, tiles[x]);
+	}
+	*out++ = '\n';
+	return fwrite(RowText, out - RowText, 1, File) == 1;
+}
+
+bool CsvWriter::EndLayer() {
+	bool ok = !ferror(File);
+	ok = fclose(File) == 0 && ok;
+	File = NULL;
+	return ok;
+}
+
+bool CsvWriter::EndMap() {
+	return true;
+}
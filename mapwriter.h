@@ -0,0 +1,113 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MAPWRITER_H_9C52E6A0_4D7B_11E3_8F31_525400DA3F0D
+#define MAPWRITER_H_9C52E6A0_4D7B_11E3_8F31_525400DA3F0D
+
+#include <cstdio>
+#include <cstdint>
+
+struct MapLayer;
+
+// Receives the tiles of each layer row by row, as soon as the layer is solved,
+// so that nothing bigger than a row has to be kept around.
+class IMapWriter {
+public:
+	enum { NO_TILE = -1 };
+
+	virtual ~IMapWriter() {
+	}
+
+	// Called before the first layer is solved; layers[0..num_layers-1] all have tiles
+	virtual bool BeginMap(unsigned int width, unsigned int height,
+		const MapLayer * layers, unsigned int num_layers) = 0;
+
+	virtual bool BeginLayer(unsigned int layer) = 0;
+
+	// Tile indices for a whole row, NO_TILE where the layer isn't used
+	virtual bool WriteRow(const int * tiles) = 0;
+
+	virtual bool EndLayer() = 0;
+	virtual bool EndMap() = 0;
+};
+
+// Tiled map (.tmx), with one tileset and one tile layer for each map layer.
+// The tilesets reference the tile images where they were loaded from.
+class TmxWriter : public IMapWriter {
+public:
+	enum Encoding { ENCODING_CSV, ENCODING_BASE64 };
+
+	TmxWriter(const char * filename, Encoding encoding = ENCODING_CSV,
+		unsigned int tile_width = 32, unsigned int tile_height = 32);
+	virtual ~TmxWriter();
+
+	virtual bool BeginMap(unsigned int width, unsigned int height,
+		const MapLayer * layers, unsigned int num_layers);
+	virtual bool BeginLayer(unsigned int layer);
+	virtual bool WriteRow(const int * tiles);
+	virtual bool EndLayer();
+	virtual bool EndMap();
+
+private:
+	void Base64(const unsigned char * data, unsigned int size, char * & out);
+
+	const char * FileName;
+	FILE * File;
+	Encoding DataEncoding;
+	unsigned int TileWidth;
+	unsigned int TileHeight;
+	unsigned int Width;
+	unsigned int Height;
+	const MapLayer * Layers;
+	unsigned int * FirstGid;
+	unsigned int CurrentLayer;
+	unsigned int CurrentRow;
+	char * RowText;
+	unsigned char * RowData;
+	unsigned char Pending[3];
+	unsigned int PendingBytes;
+};
+
+// Plain comma separated tile indices, one file for each layer: <prefix><layer>.csv
+class CsvWriter : public IMapWriter {
+public:
+	CsvWriter(const char * prefix);
+	virtual ~CsvWriter();
+
+	virtual bool BeginMap(unsigned int width, unsigned int height,
+		const MapLayer * layers, unsigned int num_layers);
+	virtual bool BeginLayer(unsigned int layer);
+	virtual bool WriteRow(const int * tiles);
+	virtual bool EndLayer();
+	virtual bool EndMap();
+
+private:
+	const char * Prefix;
+	FILE * File;
+	unsigned int Width;
+	char * RowText;
+};
+
+#endif // MAPWRITER_H_9C52E6A0_4D7B_11E3_8F31_525400DA3F0D
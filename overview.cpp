@@ -0,0 +1,223 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "overview.h"
+#include "map.h"
+
+#include <cmath>
+#include <cstring>
+
+// Colour of what is below the lowest layer, and then of each layer
+static const sf::Color LayerColors[] = {
+	sf::Color( 20,  40, 110),
+	sf::Color(200, 180, 120),
+	sf::Color( 70, 140,  60),
+	sf::Color(130, 120, 110),
+	sf::Color(240, 240, 240),
+};
+static const unsigned int NumLayerColors = sizeof(LayerColors) / sizeof(LayerColors[0]);
+
+static inline sf::Color LayerColor(unsigned int layer) {
+	return LayerColors[layer < NumLayerColors ? layer : NumLayerColors - 1];
+}
+
+MapOverview::MapOverview() :
+		TileSize(32),
+		FirstLevel(0),
+		Stopping(false) {
+}
+
+void MapOverview::Upload(Level & level) {
+	const sf::Uint8 * pixels = &level.Pixels[0];
+	level.ChunksX = (level.Width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	level.ChunksY = (level.Height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	level.Chunks.resize(level.ChunksX * level.ChunksY);
+
+	std::vector<sf::Uint8> chunk_pixels(CHUNK_SIZE * CHUNK_SIZE * 4);
+	for (unsigned int cy = 0; cy < level.ChunksY; ++cy) {
+		for (unsigned int cx = 0; cx < level.ChunksX; ++cx) {
+			unsigned int x0 = cx * CHUNK_SIZE;
+			unsigned int y0 = cy * CHUNK_SIZE;
+			unsigned int w = x0 + CHUNK_SIZE < level.Width ? (unsigned int)CHUNK_SIZE : level.Width - x0;
+			unsigned int h = y0 + CHUNK_SIZE < level.Height ? (unsigned int)CHUNK_SIZE : level.Height - y0;
+			for (unsigned int y = 0; y < h; ++y) {
+				memcpy(&chunk_pixels[y * w * 4], pixels + ((size_t)(y0 + y) * level.Width + x0) * 4, w * 4);
+			}
+			sf::Texture & texture = level.Chunks[cy * level.ChunksX + cx];
+			texture.create(w, h);
+			texture.update(&chunk_pixels[0]);
+			texture.setSmooth(true);
+		}
+	}
+	std::vector<sf::Uint8>().swap(level.Pixels);
+}
+
+void MapOverview::Build(const Map & map) {
+	Compute(map);
+	Upload();
+}
+
+void MapOverview::Upload() {
+	for (unsigned int i = 0; i < Levels.size(); ++i) {
+		if (!Levels[i].Pixels.empty()) Upload(Levels[i]);
+	}
+}
+
+void MapOverview::Compute(const Map & map) {
+	Levels.clear();
+
+	// Colour of each tile of each layer, indexed by layer and then tile
+	std::vector<const ITileSet *> layer_tiles;
+	std::vector< std::vector<sf::Color> > tile_colors;
+	for (unsigned int i = 1; map.Layers[i].Tiles != NULL; ++i) {
+		const TileSet * tiles = map.Layers[i].Tiles;
+		sf::Color below = LayerColor(i - 1);
+		sf::Color above = LayerColor(i);
+		std::vector<sf::Color> colors(tiles->NumTiles());
+		for (unsigned int t = 0; t < tiles->NumTiles(); ++t) {
+			int fill = tiles->Fill(t);
+			colors[t] = sf::Color(
+				(below.r * (100 - fill) + above.r * fill) / 100,
+				(below.g * (100 - fill) + above.g * fill) / 100,
+				(below.b * (100 - fill) + above.b * fill) / 100);
+		}
+		layer_tiles.push_back(tiles);
+		tile_colors.push_back(colors);
+	}
+	if (layer_tiles.empty()) return;
+	TileSize = map.StartingLayer->Tiles->GetSprite(0).getTextureRect().width;
+
+	// Levels too big to be kept around are skipped
+	FirstLevel = 0;
+	while ((size_t)(map.Width >> FirstLevel) * (map.Height >> FirstLevel) > MAX_TEXELS) ++FirstLevel;
+
+	// Textures are never copied, levels are only ever added at the end
+	Levels.push_back(Level());
+	Level * level = &Levels.back();
+	unsigned int step = 1 << FirstLevel;
+	level->Width = (map.Width + step - 1) >> FirstLevel;
+	level->Height = (map.Height + step - 1) >> FirstLevel;
+	level->Pixels.resize((size_t)level->Width * level->Height * 4);
+	std::vector<sf::Uint8> & pixels = level->Pixels;
+
+	map.Pool->ParallelFor(0, level->Height, 16, [&](unsigned int row_begin, unsigned int row_end) {
+		for (unsigned int ty = row_begin; ty < row_end && !Stopping; ++ty) {
+			for (unsigned int tx = 0; tx < level->Width; ++tx) {
+				unsigned int r = 0, g = 0, b = 0, n = 0;
+				for (unsigned int y = ty * step; y < (ty + 1) * step && y < map.Height; ++y) {
+					for (unsigned int x = tx * step; x < (tx + 1) * step && x < map.Width; ++x) {
+						const TileSet::TileRuntime * runtime = map.Cell(x, y).TileRuntimeData;
+						sf::Color color = LayerColor(0);
+						for (unsigned int l = 0; runtime && l < layer_tiles.size(); ++l) {
+							if (runtime->Owner == layer_tiles[l]) {
+								color = tile_colors[l][runtime->Index];
+								break;
+							}
+						}
+						r += color.r;
+						g += color.g;
+						b += color.b;
+						++n;
+					}
+				}
+				sf::Uint8 * pixel = &pixels[((size_t)ty * level->Width + tx) * 4];
+				pixel[0] = r / n;
+				pixel[1] = g / n;
+				pixel[2] = b / n;
+				pixel[3] = 255;
+			}
+		}
+	});
+
+	while ((level->Width > 1 || level->Height > 1) && !Stopping) {
+		// Each texel of the next level is the average of 2x2 texels of this one
+		Levels.push_back(Level());
+		const Level & prev = Levels[Levels.size() - 2];
+		Level & next = Levels.back();
+		next.Width = (prev.Width + 1) / 2;
+		next.Height = (prev.Height + 1) / 2;
+		next.Pixels.resize((size_t)next.Width * next.Height * 4);
+		const std::vector<sf::Uint8> & pixels = prev.Pixels;
+		std::vector<sf::Uint8> & next_pixels = next.Pixels;
+		map.Pool->ParallelFor(0, next.Height, 64, [&](unsigned int row_begin, unsigned int row_end) {
+			for (unsigned int ty = row_begin; ty < row_end && !Stopping; ++ty) {
+				unsigned int y0 = ty * 2;
+				unsigned int y1 = y0 + 1 < prev.Height ? y0 + 1 : y0;
+				for (unsigned int tx = 0; tx < next.Width; ++tx) {
+					unsigned int x0 = tx * 2;
+					unsigned int x1 = x0 + 1 < prev.Width ? x0 + 1 : x0;
+					for (unsigned int c = 0; c < 4; ++c) {
+						unsigned int sum =
+							pixels[((size_t)y0 * prev.Width + x0) * 4 + c] +
+							pixels[((size_t)y0 * prev.Width + x1) * 4 + c] +
+							pixels[((size_t)y1 * prev.Width + x0) * 4 + c] +
+							pixels[((size_t)y1 * prev.Width + x1) * 4 + c];
+						next_pixels[((size_t)ty * next.Width + tx) * 4 + c] = sum / 4;
+					}
+				}
+			}
+		});
+		level = &next;
+	}
+	if (Stopping) Levels.clear();
+}
+
+unsigned int MapOverview::Draw(sf::RenderTarget & target, float offset_x, float offset_y, float zoom) const {
+	if (!IsBuilt()) return 0;
+
+	// The first level whose texels are at least a screen pixel
+	float texel_pixels = TileSize * zoom * (1 << FirstLevel);
+	unsigned int index = 0;
+	while (texel_pixels < 1 && index + 1 < Levels.size()) {
+		texel_pixels *= 2;
+		++index;
+	}
+	const Level & level = Levels[index];
+	float texel_size = TileSize * (float)(1u << (FirstLevel + index)); // In map pixels
+
+	// Chunks seen on screen
+	sf::Vector2u screen_size = target.getSize();
+	float chunk_size = texel_size * CHUNK_SIZE;
+	signed int first_cx = floorf(offset_x / chunk_size);
+	signed int first_cy = floorf(offset_y / chunk_size);
+	signed int last_cx = floorf((offset_x + screen_size.x / zoom) / chunk_size);
+	signed int last_cy = floorf((offset_y + screen_size.y / zoom) / chunk_size);
+	if (first_cx < 0) first_cx = 0;
+	if (first_cy < 0) first_cy = 0;
+	if (last_cx >= (signed int)level.ChunksX) last_cx = level.ChunksX - 1;
+	if (last_cy >= (signed int)level.ChunksY) last_cy = level.ChunksY - 1;
+
+	unsigned int draw_calls = 0;
+	for (signed int cy = first_cy; cy <= last_cy; ++cy) {
+		for (signed int cx = first_cx; cx <= last_cx; ++cx) {
+			sf::Sprite sprite(level.Chunks[cy * level.ChunksX + cx]);
+			sprite.setPosition(floorf((cx * chunk_size - offset_x) * zoom), floorf((cy * chunk_size - offset_y) * zoom));
+			sprite.setScale(texel_pixels, texel_pixels);
+			target.draw(sprite);
+			++draw_calls;
+		}
+	}
+	return draw_calls;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef OVERVIEW_H_C41F7E62_4F2A_11E3_8B5D_525400DA3F0D
+#define OVERVIEW_H_C41F7E62_4F2A_11E3_8B5D_525400DA3F0D
+
+#include <SFML/Graphics.hpp>
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+struct Map;
+
+// Downsampled views of the whole map, for when the tiles would be too small to
+// be seen. Each cell gets the colour of the layer of its tile, mixed with the
+// colour of the layer below as much as the tile isn't filled. Level l has a
+// texel for every 2^l x 2^l cells, and is split into chunks of CHUNK_SIZE
+// texels, so that any view can be drawn with a handful of sprites.
+class MapOverview {
+public:
+	enum {
+		CHUNK_SIZE = 512,
+		MAX_TEXELS = 1 << 24, // Size of the most detailed level, at most
+	};
+
+	MapOverview();
+
+	// Has to be called again whenever the tiles of the map change. Compute
+	// can be run in any thread, and Upload then makes the textures in the
+	// thread that draws them.
+	void Build(const Map & map);
+	void Compute(const Map & map);
+	void Upload();
+
+	// Makes Compute give up as soon as it can, leaving nothing to draw
+	inline void Stop() {
+		Stopping = true;
+	}
+
+	inline bool IsBuilt() const {
+		return !Levels.empty() && Levels[0].Pixels.empty();
+	}
+
+	// Draws the part of the map seen from (offset_x, offset_y), in map pixels,
+	// at zoom screen pixels for each map pixel. Returns the draw calls made.
+	unsigned int Draw(sf::RenderTarget & target, float offset_x, float offset_y, float zoom) const;
+
+private:
+	struct Level {
+		unsigned int Width;
+		unsigned int Height;
+		unsigned int ChunksX;
+		unsigned int ChunksY;
+		std::vector<sf::Texture> Chunks;
+		std::vector<sf::Uint8> Pixels; // Until they are uploaded
+	};
+
+	void Upload(Level & level);
+
+	unsigned int TileSize;   // Size of a tile, in map pixels
+	unsigned int FirstLevel; // Cells of each texel of Levels[0], as a power of 2
+	std::deque<Level> Levels;
+	std::atomic<bool> Stopping;
+};
+
+#endif // OVERVIEW_H_C41F7E62_4F2A_11E3_8B5D_525400DA3F0D
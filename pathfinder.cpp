@@ -0,0 +1,504 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "pathfinder.h"
+#include "collision.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <functional>
+
+// Entrances at least this long get one at each end instead of one in the middle
+static const unsigned int LongEntrance = 6;
+
+static inline unsigned int Octile(PathFinder::Point a, PathFinder::Point b) {
+	unsigned int dx = a.X > b.X ? a.X - b.X : b.X - a.X;
+	unsigned int dy = a.Y > b.Y ? a.Y - b.Y : b.Y - a.Y;
+	if (dx < dy) std::swap(dx, dy);
+	return PathFinder::STRAIGHT_COST * (dx - dy) + PathFinder::DIAGONAL_COST * dy;
+}
+
+static inline bool operator==(PathFinder::Point a, PathFinder::Point b) {
+	return a.X == b.X && a.Y == b.Y;
+}
+
+typedef std::greater< std::pair<unsigned int, unsigned int> > MinFirst;
+
+void PathFinder::Scratch::Reset(unsigned int size) {
+	if (Stamp.size() < size) {
+		Cost.resize(size);
+		Parent.resize(size);
+		Stamp.assign(size, 0);
+		Current = 0;
+	}
+	if (++Current == 0) {
+		std::fill(Stamp.begin(), Stamp.end(), 0);
+		Current = 1;
+	}
+	Heap.clear();
+}
+
+PathFinder::PathFinder() :
+		Grid(NULL),
+		ClusterSize(CLUSTER_SIZE),
+		ClustersX(0),
+		ClustersY(0),
+		Stopping(false) {
+}
+
+PathFinder::Rect PathFinder::ClusterRect(unsigned int cluster) const {
+	Rect rect;
+	rect.X0 = (cluster % ClustersX) * ClusterSize;
+	rect.Y0 = (cluster / ClustersX) * ClusterSize;
+	rect.X1 = std::min(rect.X0 + ClusterSize, Grid->Width());
+	rect.Y1 = std::min(rect.Y0 + ClusterSize, Grid->Height());
+	return rect;
+}
+
+// Coordinates below 0 wrap around, and so are outside too
+inline bool PathFinder::Free(const Rect & rect, unsigned int x, unsigned int y) const {
+	return x >= rect.X0 && x < rect.X1 && y >= rect.Y0 && y < rect.Y1 && !Grid->Blocked(x, y);
+}
+
+void PathFinder::Build(const CollisionGrid & grid, unsigned int cluster_size) {
+	Grid = &grid;
+	ClusterSize = cluster_size ? cluster_size : (unsigned int)CLUSTER_SIZE;
+	ClustersX = (grid.Width() + ClusterSize - 1) / ClusterSize;
+	ClustersY = (grid.Height() + ClusterSize - 1) / ClusterSize;
+
+	Entrances.assign(ClustersX * ClustersY * 2, std::vector<Point>());
+	ThreadPool::Instance().ParallelFor(0, ClustersX * ClustersY, 16, [this](unsigned int begin, unsigned int end) {
+		for (unsigned int c = begin; c < end && !Stopping; ++c) {
+			FindEntrances(c, 0);
+			FindEntrances(c, 1);
+		}
+	});
+	if (Stopping) return;
+	LinkNodes();
+	Distances.assign(ClustersX * ClustersY, std::vector<unsigned int>());
+	ThreadPool::Instance().ParallelFor(0, ClustersX * ClustersY, 16, [this](unsigned int begin, unsigned int end) {
+		Scratch scratch;
+		for (unsigned int c = begin; c < end && !Stopping; ++c) FindDistances(c, scratch);
+	});
+}
+
+void PathFinder::Update(unsigned int x_begin, unsigned int y_begin, unsigned int x_end, unsigned int y_end) {
+	if (!Grid) return;
+	x_end = std::min(x_end, Grid->Width());
+	y_end = std::min(y_end, Grid->Height());
+	if (x_begin >= x_end || y_begin >= y_end) return;
+
+	// Borders with cells in the rectangle on either side: those of the
+	// clusters in it, and of the clusters right before them
+	unsigned int cx_begin = x_begin / ClusterSize, cx_end = (x_end - 1) / ClusterSize + 1;
+	unsigned int cy_begin = y_begin / ClusterSize, cy_end = (y_end - 1) / ClusterSize + 1;
+	std::vector<unsigned int> borders;
+	for (unsigned int cy = cy_begin ? cy_begin - 1 : 0; cy < cy_end; ++cy) {
+		for (unsigned int cx = cx_begin ? cx_begin - 1 : 0; cx < cx_end; ++cx) {
+			Rect rect = ClusterRect(cy * ClustersX + cx);
+			if (rect.X1 - 1 < x_end && x_begin <= rect.X1 && rect.Y0 < y_end && y_begin < rect.Y1) {
+				borders.push_back((cy * ClustersX + cx) * 2);
+			}
+			if (rect.Y1 - 1 < y_end && y_begin <= rect.Y1 && rect.X0 < x_end && x_begin < rect.X1) {
+				borders.push_back((cy * ClustersX + cx) * 2 + 1);
+			}
+		}
+	}
+	ThreadPool::Instance().ParallelFor(0, borders.size(), 16, [this, &borders](unsigned int begin, unsigned int end) {
+		for (unsigned int i = begin; i < end; ++i) FindEntrances(borders[i] / 2, borders[i] % 2);
+	});
+
+	std::vector<Node> old_nodes;
+	std::vector<unsigned int> old_cluster_nodes;
+	old_nodes.swap(Nodes);
+	old_cluster_nodes.swap(ClusterNodes);
+	LinkNodes();
+
+	// The other clusters keep their distances if their entrances stay where
+	// they were, in the same order
+	std::vector<unsigned int> changed;
+	for (unsigned int c = 0; c < ClustersX * ClustersY; ++c) {
+		Rect rect = ClusterRect(c);
+		bool dirty = rect.X0 < x_end && x_begin < rect.X1 && rect.Y0 < y_end && y_begin < rect.Y1;
+		unsigned int first = ClusterNodes[c], count = ClusterNodes[c + 1] - first;
+		unsigned int old_first = old_cluster_nodes[c];
+		if (count != old_cluster_nodes[c + 1] - old_first) dirty = true;
+		for (unsigned int i = 0; i < count && !dirty; ++i) {
+			dirty = !(Nodes[first + i].Where == old_nodes[old_first + i].Where);
+		}
+		if (dirty) changed.push_back(c);
+	}
+	ThreadPool::Instance().ParallelFor(0, changed.size(), 4, [this, &changed](unsigned int begin, unsigned int end) {
+		Scratch scratch;
+		for (unsigned int i = begin; i < end; ++i) FindDistances(changed[i], scratch);
+	});
+}
+
+void PathFinder::FindEntrances(unsigned int cluster, unsigned int side) {
+	std::vector<Point> & pairs = Entrances[cluster * 2 + side];
+	pairs.clear();
+	unsigned int cx = cluster % ClustersX, cy = cluster / ClustersX;
+	bool right = side == 0;
+	if (right ? cx + 1 == ClustersX : cy + 1 == ClustersY) return;
+
+	Rect rect = ClusterRect(cluster);
+	unsigned int length = right ? rect.Y1 - rect.Y0 : rect.X1 - rect.X0;
+	unsigned int begin = 0;
+	for (unsigned int i = 0; i <= length; ++i) {
+		Point inside, outside;
+		inside.X = right ? rect.X1 - 1 : rect.X0 + i;
+		inside.Y = right ? rect.Y0 + i : rect.Y1 - 1;
+		outside.X = right ? inside.X + 1 : inside.X;
+		outside.Y = right ? inside.Y : inside.Y + 1;
+		if (i < length && !Grid->Blocked(inside.X, inside.Y) && !Grid->Blocked(outside.X, outside.Y)) continue;
+
+		// End of a stretch of free cells on both sides
+		if (i > begin) {
+			unsigned int at[2] = { begin, i - 1 };
+			unsigned int n = 2;
+			if (i - begin < LongEntrance) {
+				at[0] = (begin + i - 1) / 2;
+				n = 1;
+			}
+			for (unsigned int k = 0; k < n; ++k) {
+				Point a, b;
+				a.X = right ? rect.X1 - 1 : rect.X0 + at[k];
+				a.Y = right ? rect.Y0 + at[k] : rect.Y1 - 1;
+				b.X = right ? a.X + 1 : a.X;
+				b.Y = right ? a.Y : a.Y + 1;
+				pairs.push_back(a);
+				pairs.push_back(b);
+			}
+		}
+		begin = i + 1;
+	}
+}
+
+void PathFinder::LinkNodes() {
+	unsigned int num_clusters = ClustersX * ClustersY;
+
+	// Nodes sorted by cluster, keeping the order in which they were found
+	ClusterNodes.assign(num_clusters + 1, 0);
+	for (unsigned int e = 0; e < Entrances.size(); ++e) {
+		for (unsigned int i = 0; i < Entrances[e].size(); ++i) ++ClusterNodes[ClusterOf(Entrances[e][i]) + 1];
+	}
+	for (unsigned int c = 0; c < num_clusters; ++c) ClusterNodes[c + 1] += ClusterNodes[c];
+	Nodes.resize(ClusterNodes[num_clusters]);
+	std::vector<unsigned int> next(ClusterNodes.begin(), ClusterNodes.end() - 1);
+	for (unsigned int e = 0; e < Entrances.size(); ++e) {
+		const std::vector<Point> & pairs = Entrances[e];
+		for (unsigned int i = 0; i < pairs.size(); i += 2) {
+			unsigned int a = next[ClusterOf(pairs[i])]++;
+			unsigned int b = next[ClusterOf(pairs[i + 1])]++;
+			Nodes[a].Where = pairs[i];
+			Nodes[a].Cluster = ClusterOf(pairs[i]);
+			Nodes[a].Partner = b;
+			Nodes[b].Where = pairs[i + 1];
+			Nodes[b].Cluster = ClusterOf(pairs[i + 1]);
+			Nodes[b].Partner = a;
+		}
+	}
+}
+
+void PathFinder::FindDistances(unsigned int cluster, Scratch & scratch) {
+	Rect rect = ClusterRect(cluster);
+	unsigned int width = rect.X1 - rect.X0;
+	unsigned int first = ClusterNodes[cluster], count = ClusterNodes[cluster + 1] - first;
+	std::vector<unsigned int> & distances = Distances[cluster];
+	distances.assign(count * count, UNREACHABLE);
+	for (unsigned int i = 0; i < count; ++i) {
+		CellCosts(scratch, rect, Nodes[first + i].Where);
+		for (unsigned int j = 0; j < count; ++j) {
+			Point p = Nodes[first + j].Where;
+			unsigned int cell = (p.Y - rect.Y0) * width + p.X - rect.X0;
+			if (scratch.Seen(cell)) distances[i * count + j] = scratch.Cost[cell];
+		}
+	}
+}
+
+void PathFinder::CellCosts(Scratch & scratch, const Rect & rect, Point from) const {
+	static const int Dx[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+	static const int Dy[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+	unsigned int width = rect.X1 - rect.X0;
+	scratch.Reset(ClusterSize * ClusterSize);
+
+	unsigned int start = (from.Y - rect.Y0) * width + from.X - rect.X0;
+	scratch.Stamp[start] = scratch.Current;
+	scratch.Cost[start] = 0;
+
+	// Dijkstra with a bucket for each cost, since the costs of the moves
+	// are small integers: cells are taken by increasing cost, in rounds of
+	// DIAGONAL_COST + 1 buckets.
+	std::vector<unsigned int> * buckets = scratch.Buckets;
+	for (unsigned int b = 0; b <= DIAGONAL_COST; ++b) buckets[b].clear();
+	buckets[0].push_back(start);
+	unsigned int pending = 1;
+	for (unsigned int cost = 0; pending; ++cost) {
+		std::vector<unsigned int> & bucket = buckets[cost % (DIAGONAL_COST + 1)];
+		for (unsigned int i = 0; i < bucket.size(); ++i) {
+			unsigned int cell = bucket[i];
+			--pending;
+			if (scratch.Cost[cell] != cost) continue;
+
+			unsigned int x = rect.X0 + cell % width;
+			unsigned int y = rect.Y0 + cell / width;
+			for (unsigned int d = 0; d < 8; ++d) {
+				unsigned int nx = x + Dx[d], ny = y + Dy[d];
+				if (!Free(rect, nx, ny)) continue;
+				if (d >= 4 && (!Free(rect, nx, y) || !Free(rect, x, ny))) continue;
+				unsigned int next = (ny - rect.Y0) * width + nx - rect.X0;
+				unsigned int move = d >= 4 ? DIAGONAL_COST : STRAIGHT_COST;
+				if (scratch.Seen(next) && scratch.Cost[next] <= cost + move) continue;
+				scratch.Stamp[next] = scratch.Current;
+				scratch.Cost[next] = cost + move;
+				buckets[(cost + move) % (DIAGONAL_COST + 1)].push_back(next);
+				++pending;
+			}
+		}
+		bucket.clear();
+	}
+}
+
+bool PathFinder::Jump(const Rect & rect, unsigned int x, unsigned int y, int dx, int dy, Point goal, Point & jump) const {
+	for (;;) {
+		x += dx;
+		y += dy;
+		if (!Free(rect, x, y)) return false;
+		jump.X = x;
+		jump.Y = y;
+		if (jump == goal) return true;
+
+		if (dx && dy) {
+			// Diagonal moves stop where a straight one would find something
+			Point found;
+			if (Jump(rect, x, y, dx, 0, goal, found) || Jump(rect, x, y, 0, dy, goal, found)) return true;
+			if (!Free(rect, x + dx, y) || !Free(rect, x, y + dy)) return false;
+		} else if (dx) {
+			if ((Free(rect, x, y - 1) && !Free(rect, x - dx, y - 1)) ||
+					(Free(rect, x, y + 1) && !Free(rect, x - dx, y + 1))) return true;
+		} else {
+			if ((Free(rect, x - 1, y) && !Free(rect, x - 1, y - dy)) ||
+					(Free(rect, x + 1, y) && !Free(rect, x + 1, y - dy))) return true;
+		}
+	}
+}
+
+bool PathFinder::JumpPath(Scratch & scratch, const Rect & rect, Point from, Point to, std::vector<Point> & path) const {
+	if (from == to) return true;
+	unsigned int width = rect.X1 - rect.X0;
+	scratch.Reset(ClusterSize * ClusterSize);
+
+	unsigned int start = (from.Y - rect.Y0) * width + from.X - rect.X0;
+	unsigned int goal = (to.Y - rect.Y0) * width + to.X - rect.X0;
+	scratch.Stamp[start] = scratch.Current;
+	scratch.Cost[start] = 0;
+	scratch.Parent[start] = start;
+	scratch.Heap.push_back(std::make_pair(Octile(from, to), start));
+	while (!scratch.Heap.empty()) {
+		std::pop_heap(scratch.Heap.begin(), scratch.Heap.end(), MinFirst());
+		unsigned int cell = scratch.Heap.back().second;
+		unsigned int estimate = scratch.Heap.back().first;
+		scratch.Heap.pop_back();
+		Point p = { rect.X0 + cell % width, rect.Y0 + cell / width };
+		if (estimate > scratch.Cost[cell] + Octile(p, to)) continue;
+
+		if (cell == goal) {
+			size_t end = path.size();
+			for (unsigned int c = goal; c != start; c = scratch.Parent[c]) {
+				Point q = { rect.X0 + c % width, rect.Y0 + c / width };
+				path.push_back(q);
+			}
+			std::reverse(path.begin() + end, path.end());
+			return true;
+		}
+
+		// Only the directions that can't be reached better without going
+		// through this cell
+		int dirs[8][2];
+		unsigned int n = 0;
+		if (cell == start) {
+			for (int dy = -1; dy <= 1; ++dy) {
+				for (int dx = -1; dx <= 1; ++dx) {
+					if (!dx && !dy) continue;
+					if (dx && dy && (!Free(rect, p.X + dx, p.Y) || !Free(rect, p.X, p.Y + dy))) continue;
+					dirs[n][0] = dx;
+					dirs[n][1] = dy;
+					++n;
+				}
+			}
+		} else {
+			unsigned int parent = scratch.Parent[cell];
+			int px = rect.X0 + parent % width, py = rect.Y0 + parent / width;
+			int dx = (p.X > (unsigned int)px) - (p.X < (unsigned int)px);
+			int dy = (p.Y > (unsigned int)py) - (p.Y < (unsigned int)py);
+			if (dx && dy) {
+				bool along_x = Free(rect, p.X + dx, p.Y), along_y = Free(rect, p.X, p.Y + dy);
+				if (along_y) { dirs[n][0] = 0; dirs[n][1] = dy; ++n; }
+				if (along_x) { dirs[n][0] = dx; dirs[n][1] = 0; ++n; }
+				if (along_x && along_y) { dirs[n][0] = dx; dirs[n][1] = dy; ++n; }
+			} else if (dx) {
+				bool ahead = Free(rect, p.X + dx, p.Y);
+				bool down = Free(rect, p.X, p.Y + 1), up = Free(rect, p.X, p.Y - 1);
+				if (ahead) {
+					dirs[n][0] = dx; dirs[n][1] = 0; ++n;
+					if (down) { dirs[n][0] = dx; dirs[n][1] = 1; ++n; }
+					if (up) { dirs[n][0] = dx; dirs[n][1] = -1; ++n; }
+				}
+				if (down) { dirs[n][0] = 0; dirs[n][1] = 1; ++n; }
+				if (up) { dirs[n][0] = 0; dirs[n][1] = -1; ++n; }
+			} else {
+				bool ahead = Free(rect, p.X, p.Y + dy);
+				bool right = Free(rect, p.X + 1, p.Y), left = Free(rect, p.X - 1, p.Y);
+				if (ahead) {
+					dirs[n][0] = 0; dirs[n][1] = dy; ++n;
+					if (right) { dirs[n][0] = 1; dirs[n][1] = dy; ++n; }
+					if (left) { dirs[n][0] = -1; dirs[n][1] = dy; ++n; }
+				}
+				if (right) { dirs[n][0] = 1; dirs[n][1] = 0; ++n; }
+				if (left) { dirs[n][0] = -1; dirs[n][1] = 0; ++n; }
+			}
+		}
+
+		for (unsigned int i = 0; i < n; ++i) {
+			Point jump;
+			if (!Jump(rect, p.X, p.Y, dirs[i][0], dirs[i][1], to, jump)) continue;
+			unsigned int next = (jump.Y - rect.Y0) * width + jump.X - rect.X0;
+			unsigned int next_cost = scratch.Cost[cell] + Octile(p, jump);
+			if (scratch.Seen(next) && scratch.Cost[next] <= next_cost) continue;
+			scratch.Stamp[next] = scratch.Current;
+			scratch.Cost[next] = next_cost;
+			scratch.Parent[next] = cell;
+			scratch.Heap.push_back(std::make_pair(next_cost + Octile(jump, to), next));
+			std::push_heap(scratch.Heap.begin(), scratch.Heap.end(), MinFirst());
+		}
+	}
+	return false;
+}
+
+bool PathFinder::FindPath(Point from, Point to, std::vector<Point> & path, unsigned int * cost) {
+	path.clear();
+	if (!Grid || Stopping || Grid->Blocked(from.X, from.Y) || Grid->Blocked(to.X, to.Y)) return false;
+
+	// Moving diagonally only between free cells, the regions of the grid are
+	// exactly the places that can be reached from each other
+	if (Grid->Region(from.X, from.Y) != Grid->Region(to.X, to.Y)) return false;
+
+	path.push_back(from);
+	unsigned int from_cluster = ClusterOf(from);
+	unsigned int to_cluster = ClusterOf(to);
+	if (from_cluster == to_cluster && JumpPath(Query, ClusterRect(from_cluster), from, to, path)) {
+		if (cost) {
+			*cost = 0;
+			for (unsigned int i = 1; i < path.size(); ++i) *cost += Octile(path[i - 1], path[i]);
+		}
+		return true;
+	}
+
+	// Costs from both ends to the entrances of their clusters
+	unsigned int from_first = ClusterNodes[from_cluster];
+	unsigned int to_first = ClusterNodes[to_cluster];
+	std::vector<unsigned int> from_costs(ClusterNodes[from_cluster + 1] - from_first, UNREACHABLE);
+	std::vector<unsigned int> to_costs(ClusterNodes[to_cluster + 1] - to_first, UNREACHABLE);
+	for (unsigned int end = 0; end < 2; ++end) {
+		unsigned int cluster = end ? to_cluster : from_cluster;
+		unsigned int first = end ? to_first : from_first;
+		std::vector<unsigned int> & costs = end ? to_costs : from_costs;
+		Rect rect = ClusterRect(cluster);
+		CellCosts(Query, rect, end ? to : from);
+		for (unsigned int i = 0; i < costs.size(); ++i) {
+			Point p = Nodes[first + i].Where;
+			unsigned int cell = (p.Y - rect.Y0) * (rect.X1 - rect.X0) + p.X - rect.X0;
+			if (Query.Seen(cell)) costs[i] = Query.Cost[cell];
+		}
+	}
+
+	// A* over the entrances, with the ends of the path as two more nodes
+	unsigned int start = Nodes.size(), goal = Nodes.size() + 1;
+	Scratch & s = Abstract;
+	s.Reset(Nodes.size() + 2);
+	s.Stamp[start] = s.Current;
+	s.Cost[start] = 0;
+	s.Parent[start] = start;
+	s.Heap.push_back(std::make_pair(Octile(from, to), start));
+	auto relax = [&](unsigned int node, unsigned int next, unsigned int next_cost) {
+		if (s.Seen(next) && s.Cost[next] <= next_cost) return;
+		s.Stamp[next] = s.Current;
+		s.Cost[next] = next_cost;
+		s.Parent[next] = node;
+		s.Heap.push_back(std::make_pair(next_cost + Octile(next == goal ? to : Nodes[next].Where, to), next));
+		std::push_heap(s.Heap.begin(), s.Heap.end(), MinFirst());
+	};
+	bool found = false;
+	while (!s.Heap.empty()) {
+		std::pop_heap(s.Heap.begin(), s.Heap.end(), MinFirst());
+		unsigned int node = s.Heap.back().second;
+		unsigned int estimate = s.Heap.back().first;
+		s.Heap.pop_back();
+		if (node == goal) {
+			found = true;
+			break;
+		}
+		Point where = node == start ? from : Nodes[node].Where;
+		if (estimate > s.Cost[node] + Octile(where, to)) continue;
+
+		if (node == start) {
+			for (unsigned int i = 0; i < from_costs.size(); ++i) {
+				if (from_costs[i] != UNREACHABLE) relax(node, from_first + i, from_costs[i]);
+			}
+			continue;
+		}
+		const Node & current = Nodes[node];
+		relax(node, current.Partner, s.Cost[node] + STRAIGHT_COST);
+		unsigned int first = ClusterNodes[current.Cluster];
+		unsigned int count = ClusterNodes[current.Cluster + 1] - first;
+		const unsigned int * distances = &Distances[current.Cluster][(node - first) * count];
+		for (unsigned int i = 0; i < count; ++i) {
+			if (distances[i] != UNREACHABLE && first + i != node) relax(node, first + i, s.Cost[node] + distances[i]);
+		}
+		if (current.Cluster == to_cluster && to_costs[node - to_first] != UNREACHABLE) {
+			relax(node, goal, s.Cost[node] + to_costs[node - to_first]);
+		}
+	}
+	if (!found) {
+		path.clear();
+		return false;
+	}
+	if (cost) *cost = s.Cost[goal];
+
+	// Refined inside each cluster, from the start onwards
+	std::vector<unsigned int> route;
+	for (unsigned int node = goal; node != start; node = s.Parent[node]) route.push_back(node);
+	Point last = from;
+	for (unsigned int i = route.size(); i-- > 0; ) {
+		Point next = route[i] == goal ? to : Nodes[route[i]].Where;
+		if (ClusterOf(last) != ClusterOf(next)) {
+			path.push_back(next); // Across the border, to the partner
+		} else {
+			JumpPath(Query, ClusterRect(ClusterOf(last)), last, next, path);
+		}
+		last = next;
+	}
+	return true;
+}
@@ -0,0 +1,149 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef PATHFINDER_H_B3E1C5A8_4F3B_11E3_8D27_525400DA3F0D
+#define PATHFINDER_H_B3E1C5A8_4F3B_11E3_8D27_525400DA3F0D
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+class CollisionGrid;
+
+// Paths over the walkable parts of a CollisionGrid, moving in 8 directions
+// without cutting corners. The grid is split into square clusters: the
+// free cells on both sides of the border between two clusters make their
+// entrances, and the distances between the entrances of each cluster are
+// worked out beforehand. A path is then searched over the entrances, and
+// only refined inside the clusters it goes through, with jump point search.
+class PathFinder {
+public:
+	enum {
+		CLUSTER_SIZE = 32,
+		STRAIGHT_COST = 10,
+		DIAGONAL_COST = 14,
+	};
+
+	struct Point {
+		unsigned int X;
+		unsigned int Y;
+	};
+
+	PathFinder();
+
+	// The grid has to outlive the path finder
+	void Build(const CollisionGrid & grid, unsigned int cluster_size = CLUSTER_SIZE);
+
+	// After the grid has changed in [x_begin, x_end) x [y_begin, y_end), in
+	// sub-cells. Only the entrances on the borders next to the rectangle are
+	// found again, and only the clusters in it, or whose entrances moved, get
+	// their distances worked out again. Gives the same paths as Build would.
+	void Update(unsigned int x_begin, unsigned int y_begin, unsigned int x_end, unsigned int y_end);
+
+	// Makes Build give up as soon as it can, for when it runs in another
+	// thread that has to be stopped. No path is found after that.
+	inline void Stop() {
+		Stopping = true;
+	}
+
+	// Fills path with the points where it changes direction, from and to
+	// included, each one reached from the previous one in a straight line.
+	// Only one path can be searched at a time.
+	bool FindPath(Point from, Point to, std::vector<Point> & path, unsigned int * cost = NULL);
+
+	inline unsigned int NumNodes() const {
+		return Nodes.size();
+	}
+
+private:
+	enum { UNREACHABLE = ~0u };
+
+	struct Rect {
+		unsigned int X0;
+		unsigned int Y0;
+		unsigned int X1;
+		unsigned int Y1;
+	};
+
+	// Entrance to a cluster, next to the one of Partner in the next cluster
+	struct Node {
+		Point Where;
+		unsigned int Cluster;
+		unsigned int Partner;
+	};
+
+	// Search state for the cells of a cluster, one for each thread
+	struct Scratch {
+		Scratch() : Current(0) {
+		}
+		void Reset(unsigned int size);
+		inline bool Seen(unsigned int i) const {
+			return Stamp[i] == Current;
+		}
+
+		std::vector<unsigned int> Cost;
+		std::vector<unsigned int> Parent;
+		std::vector<unsigned int> Stamp;
+		unsigned int Current;
+		std::vector< std::pair<unsigned int, unsigned int> > Heap; // Cost and cell
+		std::vector<unsigned int> Buckets[DIAGONAL_COST + 1];
+	};
+
+	inline unsigned int ClusterOf(Point p) const {
+		return (p.Y / ClusterSize) * ClustersX + p.X / ClusterSize;
+	}
+
+	Rect ClusterRect(unsigned int cluster) const;
+	bool Free(const Rect & rect, unsigned int x, unsigned int y) const;
+
+	// Entrances on the right (side 0) or bottom (side 1) border of a cluster
+	void FindEntrances(unsigned int cluster, unsigned int side);
+	void LinkNodes();
+	void FindDistances(unsigned int cluster, Scratch & scratch);
+
+	// Costs from (x, y) to every cell of the rectangle it is in, in scratch
+	void CellCosts(Scratch & scratch, const Rect & rect, Point from) const;
+
+	// Jump point search inside the rectangle, appending the points after from
+	bool JumpPath(Scratch & scratch, const Rect & rect, Point from, Point to, std::vector<Point> & path) const;
+	bool Jump(const Rect & rect, unsigned int x, unsigned int y, int dx, int dy, Point goal, Point & jump) const;
+
+	const CollisionGrid * Grid;
+	unsigned int ClusterSize;
+	unsigned int ClustersX;
+	unsigned int ClustersY;
+
+	std::vector< std::vector<Point> > Entrances; // Of each border, inside then outside
+	std::vector<Node> Nodes;                   // Sorted by cluster
+	std::vector<unsigned int> ClusterNodes;    // First node of each cluster, and the total at the end
+	std::vector< std::vector<unsigned int> > Distances; // Between the nodes of each cluster, row after row
+
+	// Search over the nodes, with two more for the ends of the path
+	Scratch Query;
+	Scratch Abstract;
+	std::atomic<bool> Stopping;
+};
+
+#endif // PATHFINDER_H_B3E1C5A8_4F3B_11E3_8D27_525400DA3F0D
@@ -0,0 +1,340 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "patterncache.h"
+#include "tileset.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+static const char PatternCacheMagic[4] = { 'T', 'P', 'C', '2' };
+
+// Cost of using a tile in a cell whose best guess is another one
+static const int NotGuessedError = 40;
+static const int WrongFillError = 80;
+
+// More than any block can cost, and still safe to add up a few times
+static const int NoMatch = 1 << 20;
+
+static inline uint32_t HashWord(uint32_t hash, uint32_t word) {
+	for (unsigned int i = 0; i < 4; ++i) {
+		hash ^= (word >> (i * 8)) & 0xFF;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// w[dy+2][dx+2] is the threshold bit of the window; the environment of the
+// cell at (ox, oy) is built just like Map::SetupInitialTiles does it.
+static uint32_t WindowEnv(const bool w[5][5], int ox, int oy) {
+	bool c =  w[oy+2][ox+2];
+	bool l =  w[oy+2][ox+1];
+	bool r =  w[oy+2][ox+3];
+	bool u =  w[oy+3][ox+2];
+	bool d =  w[oy+1][ox+2];
+	bool ul = w[oy+3][ox+1];
+	bool ur = w[oy+3][ox+3];
+	bool dl = w[oy+1][ox+1];
+	bool dr = w[oy+1][ox+3];
+
+	if (!u && !d && !l && !r) c = false;
+	if (u && d && l && r) c = true;
+
+	return
+		(ul?0x100:0)+( u?0x080:0)+(ur?0x040:0)+
+		( l?0x020:0)+( c?0x010:0)+( r?0x008:0)+
+		(dl?0x004:0)+( d?0x002:0)+(dr?0x001:0);
+}
+
+PatternCache::PatternCache(const ITileSet * tiles) :
+		Tiles(tiles),
+		NumberOfTiles(tiles->NumTiles()),
+		Signature(2166136261u),
+		Table(NULL),
+		GuessTable(NULL),
+		FitError(NULL),
+		MatchRight(NULL),
+		MatchDown(NULL),
+		Stopping(false) {
+	Table = new unsigned char[NUM_PATTERNS];
+	memset(Table, UNSOLVED, NUM_PATTERNS);
+
+	GuessTable = new unsigned int[512];
+	FitError = new int[512 * NumberOfTiles];
+	for (uint32_t env = 0; env < 512; ++env) {
+		GuessTable[env] = Guess(env);
+		bool solid = (env & 0x010) != 0;
+		for (unsigned int t = 0; t < NumberOfTiles; ++t) {
+			int fill = Tiles->Fill(t);
+			int err = 0;
+			if (t != GuessTable[env]) {
+				err = (solid ? fill >= 50 : fill <= 50) ? NotGuessedError : WrongFillError;
+			}
+			FitError[env * NumberOfTiles + t] = err;
+			Signature = HashWord(Signature, err); // Depends on the fill of each tile
+		}
+		Signature = HashWord(Signature, GuessTable[env]);
+	}
+
+	// Only the edges that match exactly, like AdjustTiles wants them in the end
+	MatchRight = new bool[NumberOfTiles * NumberOfTiles];
+	MatchDown = new bool[NumberOfTiles * NumberOfTiles];
+	RightOf.resize(NumberOfTiles);
+	LeftOf.resize(NumberOfTiles);
+	Below.resize(NumberOfTiles);
+	Above.resize(NumberOfTiles);
+	for (unsigned int a = 0; a < NumberOfTiles; ++a) {
+		for (unsigned int b = 0; b < NumberOfTiles; ++b) {
+			bool right = Tiles->EdgesMatchError(Tiles->EdgeRight(a), Tiles->EdgeLeft(b)) == 0;
+			bool down = Tiles->EdgesMatchError(Tiles->EdgeDown(a), Tiles->EdgeUp(b)) == 0;
+			MatchRight[a * NumberOfTiles + b] = right;
+			MatchDown[a * NumberOfTiles + b] = down;
+			if (right) {
+				RightOf[a].push_back(b);
+				LeftOf[b].push_back(a);
+			}
+			if (down) {
+				Below[a].push_back(b);
+				Above[b].push_back(a);
+			}
+			Signature = HashWord(Signature, (right ? 1 : 0) + (down ? 2 : 0));
+		}
+	}
+	Signature = HashWord(Signature, NumberOfTiles);
+
+	// The corners of the block, up-left, up-right, down-left and down-right,
+	// each next to the tile above or below the center and the one beside it
+	for (unsigned int k = 0; k < 4; ++k) {
+		Corner[k].resize(NumberOfTiles * NumberOfTiles);
+	}
+	for (unsigned int v = 0; v < NumberOfTiles; ++v) {
+		for (unsigned int h = 0; h < NumberOfTiles; ++h) {
+			for (unsigned int t = 0; t < NumberOfTiles; ++t) {
+				unsigned int pair = v * NumberOfTiles + h;
+				if (MatchRight[t * NumberOfTiles + v] && MatchDown[t * NumberOfTiles + h]) Corner[0][pair].push_back(t);
+				if (MatchRight[v * NumberOfTiles + t] && MatchDown[t * NumberOfTiles + h]) Corner[1][pair].push_back(t);
+				if (MatchRight[t * NumberOfTiles + v] && MatchDown[h * NumberOfTiles + t]) Corner[2][pair].push_back(t);
+				if (MatchRight[v * NumberOfTiles + t] && MatchDown[h * NumberOfTiles + t]) Corner[3][pair].push_back(t);
+			}
+		}
+	}
+}
+
+PatternCache::~PatternCache() {
+	delete[] MatchDown;
+	delete[] MatchRight;
+	delete[] FitError;
+	delete[] GuessTable;
+	delete[] Table;
+}
+
+unsigned int PatternCache::Guess(uint32_t env) const {
+	if ((env & 0x0BA) == 0x0BA) return Tiles->SolidTile();
+	if ((env & 0x0BA) == 0) return Tiles->EmptyTile();
+	return Tiles->InitialTileGuess(env);
+}
+
+unsigned int PatternCache::Solve(uint32_t key, bool * rejected) const {
+	bool w[5][5];
+	unsigned int bit = KEY_BITS;
+	for (int dy = -2; dy <= 2; ++dy) {
+		for (int dx = -2; dx <= 2; ++dx) {
+			if (InWindow(dx, dy)) {
+				w[dy+2][dx+2] = (key >> --bit) & 1;
+			} else {
+				w[dy+2][dx+2] = false;
+			}
+		}
+	}
+
+	const unsigned int n = NumberOfTiles;
+	uint32_t env = WindowEnv(w, 0, 0);
+	const int * fit   = &FitError[env * n];
+	const int * up    = &FitError[WindowEnv(w,  0, -1) * n];
+	const int * down  = &FitError[WindowEnv(w,  0,  1) * n];
+	const int * left  = &FitError[WindowEnv(w, -1,  0) * n];
+	const int * right = &FitError[WindowEnv(w,  1,  0) * n];
+
+	// The corners of the window aren't in the key, so each diagonal cell
+	// is as good as the best of the two environments it may have
+	int diagonal[4][256];
+	static const int corner[4][2] = { { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 } };
+	for (unsigned int d = 0; d < 4; ++d) {
+		int dx = corner[d][0], dy = corner[d][1];
+		bool & bit = w[2 + 2*dy][2 + 2*dx];
+		bit = false;
+		const int * fit0 = &FitError[WindowEnv(w, dx, dy) * n];
+		bit = true;
+		const int * fit1 = &FitError[WindowEnv(w, dx, dy) * n];
+		bit = false;
+		for (unsigned int t = 0; t < n; ++t) {
+			diagonal[d][t] = fit0[t] < fit1[t] ? fit0[t] : fit1[t];
+		}
+	}
+
+	// A side column costs at least its middle tile and the cheapest corners
+	// above and below it, whatever the center column is
+	int column[2][256];
+	for (unsigned int t = 0; t < n; ++t) {
+		int up_corner[2] = { NoMatch, NoMatch };
+		int down_corner[2] = { NoMatch, NoMatch };
+		for (unsigned int i = 0; i < Above[t].size(); ++i) {
+			unsigned int a = Above[t][i];
+			if (diagonal[0][a] < up_corner[0]) up_corner[0] = diagonal[0][a];
+			if (diagonal[1][a] < up_corner[1]) up_corner[1] = diagonal[1][a];
+		}
+		for (unsigned int i = 0; i < Below[t].size(); ++i) {
+			unsigned int b = Below[t][i];
+			if (diagonal[2][b] < down_corner[0]) down_corner[0] = diagonal[2][b];
+			if (diagonal[3][b] < down_corner[1]) down_corner[1] = diagonal[3][b];
+		}
+		column[0][t] = left[t] + up_corner[0] + down_corner[0];
+		column[1][t] = right[t] + up_corner[1] + down_corner[1];
+	}
+
+	// Cheapest tile of a corner, next to the tiles v above or below the
+	// center and h beside it
+	auto Diagonal = [&](unsigned int k, unsigned int v, unsigned int h) {
+		const std::vector<unsigned char> & candidates = Corner[k][v * n + h];
+		int best = NoMatch;
+		for (unsigned int i = 0; i < candidates.size(); ++i) {
+			if (diagonal[k][candidates[i]] < best) best = diagonal[k][candidates[i]];
+		}
+		return best;
+	};
+
+	auto Cheapest = [](const int * cost, const std::vector<unsigned char> & candidates) {
+		int best = NoMatch;
+		for (unsigned int i = 0; i < candidates.size(); ++i) {
+			if (cost[candidates[i]] < best) best = cost[candidates[i]];
+		}
+		return best;
+	};
+
+	// The left and right columns only meet through the center column, so
+	// once it is chosen each of them is solved on its own. The plain guess
+	// comes first, and only a strictly better block replaces it.
+	unsigned int guess = GuessTable[env];
+	unsigned int best_tile = guess;
+	int best_err = NoMatch;
+	for (unsigned int ci = 0; ci < n; ++ci) {
+		unsigned int c = ci == 0 ? guess : (ci <= guess ? ci - 1 : ci);
+		if (fit[c] >= best_err) continue;
+
+		// Not even worth trying if the cheapest of each part costs too much
+		int down_bound = Cheapest(down, Below[c]);
+		int sides_bound = Cheapest(column[0], LeftOf[c]) + Cheapest(column[1], RightOf[c]);
+		if (fit[c] + Cheapest(up, Above[c]) + down_bound + sides_bound >= best_err) continue;
+
+		for (unsigned int i = 0; i < Above[c].size(); ++i) {
+			unsigned int u = Above[c][i];
+			int err_u = fit[c] + up[u];
+			if (err_u + down_bound + sides_bound >= best_err) continue;
+			for (unsigned int j = 0; j < Below[c].size(); ++j) {
+				unsigned int d = Below[c][j];
+				int err_ud = err_u + down[d];
+				if (err_ud + sides_bound >= best_err) continue;
+
+				int best_l = NoMatch;
+				for (unsigned int k = 0; k < LeftOf[c].size(); ++k) {
+					unsigned int l = LeftOf[c][k];
+					if (err_ud + column[0][l] >= best_err || column[0][l] >= best_l) continue;
+					int err = left[l];
+					err += Diagonal(0, u, l);
+					if (err_ud + err >= best_err || err >= best_l) continue;
+					err += Diagonal(2, d, l);
+					if (err < best_l) best_l = err;
+				}
+				if (err_ud + best_l >= best_err) continue;
+
+				int best_r = NoMatch;
+				for (unsigned int k = 0; k < RightOf[c].size(); ++k) {
+					unsigned int r = RightOf[c][k];
+					if (err_ud + best_l + column[1][r] >= best_err || column[1][r] >= best_r) continue;
+					int err = right[r];
+					err += Diagonal(1, u, r);
+					if (err_ud + best_l + err >= best_err || err >= best_r) continue;
+					err += Diagonal(3, d, r);
+					if (err < best_r) best_r = err;
+				}
+				if (err_ud + best_l + best_r < best_err) {
+					best_err = err_ud + best_l + best_r;
+					best_tile = c;
+				}
+			}
+		}
+	}
+	if (rejected) *rejected = best_err >= NoMatch;
+	return best_tile;
+}
+
+unsigned int PatternCache::Build() {
+	std::atomic<unsigned int> rejected(0);
+	ThreadPool & pool = ThreadPool::Instance();
+	pool.ParallelFor(0, NUM_PATTERNS, 4096, [&](unsigned int begin, unsigned int end) {
+		unsigned int range_rejected = 0;
+		for (uint32_t key = begin; key < end && !Stopping; ++key) {
+			bool no_match;
+			Table[key] = Solve(key, &no_match);
+			if (no_match) ++range_rejected;
+		}
+		rejected += range_rejected;
+	});
+	return rejected;
+}
+
+bool PatternCache::Load(const char * filename) {
+	FILE * f = fopen(filename, "rb");
+	if (!f) return false;
+
+	char magic[4];
+	uint32_t header[3];
+	bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+		fread(header, sizeof(header), 1, f) == 1 &&
+		memcmp(magic, PatternCacheMagic, sizeof(magic)) == 0 &&
+		header[0] == KEY_BITS && header[1] == NumberOfTiles && header[2] == Signature &&
+		fread(Table, NUM_PATTERNS, 1, f) == 1;
+	fclose(f);
+
+	if (!ok) {
+		printf("Ignoring pattern cache '%s'\n", filename);
+		memset(Table, UNSOLVED, NUM_PATTERNS);
+	}
+	return ok;
+}
+
+bool PatternCache::Save(const char * filename) const {
+	FILE * f = fopen(filename, "wb");
+	if (!f) return false;
+
+	uint32_t header[3] = { KEY_BITS, NumberOfTiles, Signature };
+	bool ok = fwrite(PatternCacheMagic, sizeof(PatternCacheMagic), 1, f) == 1 &&
+		fwrite(header, sizeof(header), 1, f) == 1 &&
+		fwrite(Table, NUM_PATTERNS, 1, f) == 1;
+	return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef PATTERNCACHE_H_6B1F0C2E_4D7A_11E3_9C8B_525400DA3F0D
+#define PATTERNCACHE_H_6B1F0C2E_4D7A_11E3_9C8B_525400DA3F0D
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ITileSet;
+
+// Pre-solved initial tiles for every local threshold pattern of a tile set.
+//
+// The key is the 5x5 window of threshold bits around a cell, without its four
+// corners. Bits are packed row by row (dy = -2..2, dx = -2..2), the first one
+// being the most significant. Each pattern is solved for the 3x3 block of
+// cells around the center at once: every tile of the block has to match the
+// edges of its neighbours in the block exactly, and the block that strays the
+// least from the 3x3 guess of each of its cells is kept. The cached tile is
+// the center of that block. Patterns that no block matches are rejected, and
+// get the plain 3x3 guess, for AdjustTiles to sort out.
+class PatternCache {
+public:
+	enum {
+		KEY_BITS = 21,
+		NUM_PATTERNS = 1 << KEY_BITS,
+		UNSOLVED = 0xFF,
+	};
+
+	PatternCache(const ITileSet * tiles);
+	~PatternCache();
+
+	// Solve every pattern, in parallel; about 15 seconds on a single core,
+	// which is why it's worth saving. Returns how many were rejected.
+	unsigned int Build();
+
+	// Makes Build give up as soon as it can, leaving the rest unsolved. The
+	// cache shouldn't be saved then.
+	inline void Stop() {
+		Stopping = true;
+	}
+
+	inline bool Stopped() const {
+		return Stopping;
+	}
+
+	// Binary cache file, only accepted if it was built with the same rules
+	bool Load(const char * filename);
+	bool Save(const char * filename) const;
+
+	// Patterns that are not cached yet are solved on the fly
+	inline unsigned int Lookup(uint32_t key) const {
+		unsigned char tile = Table[key];
+		return tile != UNSOLVED ? tile : Solve(key);
+	}
+
+	static inline bool InWindow(int dx, int dy) {
+		return (dx != -2 && dx != 2) || (dy != -2 && dy != 2);
+	}
+
+private:
+	// Sets rejected if no block matches
+	unsigned int Solve(uint32_t key, bool * rejected = NULL) const;
+
+	// env is a binary number representing flags that describe the environment:
+	// 0b(ul)(u)(ur)(l)(c)(r)(dl)(d)(dr)
+	unsigned int Guess(uint32_t env) const;
+
+	const ITileSet * Tiles;
+	unsigned int NumberOfTiles;
+	uint32_t Signature;
+	unsigned char * Table;
+	unsigned int * GuessTable;  // [env]
+	int * FitError;             // [env][tile]
+	bool * MatchRight;          // [left tile][right tile], edges match exactly
+	bool * MatchDown;           // [upper tile][lower tile]
+	std::vector< std::vector<unsigned char> > RightOf; // Tiles that match on each side
+	std::vector< std::vector<unsigned char> > LeftOf;
+	std::vector< std::vector<unsigned char> > Below;
+	std::vector< std::vector<unsigned char> > Above;
+	// Tiles that fit in a corner of the block, for each pair of tiles next to
+	// it: [corner][tile beside it * NumberOfTiles + tile above or below it]
+	std::vector< std::vector<unsigned char> > Corner[4];
+	std::atomic<bool> Stopping;
+};
+
+#endif // PATTERNCACHE_H_6B1F0C2E_4D7A_11E3_9C8B_525400DA3F0D
@@ -0,0 +1,234 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "seedsearch.h"
+#include "map.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+SeedSearch::SeedSearch(const Map & map, const char * backing_file) :
+		Width(map.Width),
+		Height(map.Height),
+		MinElevation(map.MinElevation),
+		MaxElevation(map.MaxElevation),
+		Blocks(map.Layout == Map::LAYOUT_BLOCKS),
+		StripeRows(map.StripeRows),
+		BackingFile(backing_file ? backing_file : ""),
+		Layers(map.Layers),
+		NumLayers(1),
+		WalkLayer(map.StartingLayer - map.Layers),
+		MinRegion(0),
+		Tried(0),
+		Stopping(false) {
+	while (Layers[NumLayers].Tiles != NULL) ++NumLayers;
+	++NumLayers;
+	MinSolid.assign(NumLayers, 0.0f);
+	MaxSolid.assign(NumLayers, 1.0f);
+}
+
+void SeedSearch::SetSolidFraction(unsigned int layer, float min, float max) {
+	if (layer == 0 || layer + 1 >= NumLayers) return;
+	MinSolid[layer] = min;
+	MaxSolid[layer] = max;
+}
+
+void SeedSearch::SetMinRegion(size_t cells) {
+	MinRegion = cells;
+}
+
+SeedSearch::Measure::Measure(const SeedSearch & search) :
+		Search(search),
+		Histogram(search.MaxElevation - search.MinElevation + 1, 0),
+		AboveBegin(0),
+		AboveEnd(0),
+		Largest(0) {
+}
+
+unsigned int SeedSearch::Measure::Root(unsigned int r) {
+	while (Parent[r] != r) {
+		Parent[r] = Parent[Parent[r]];
+		r = Parent[r];
+	}
+	return r;
+}
+
+void SeedSearch::Measure::AddRows(const Map & map, unsigned int y_begin, unsigned int y_end) {
+	signed int low = Search.Layers[Search.WalkLayer].Elevation;
+	signed int high = Search.Layers[Search.WalkLayer + 1].Elevation;
+	bool regions = Search.MinRegion != 0;
+
+	for (unsigned int y = y_begin; y < y_end; ++y) {
+		// A histogram of the elevation gives the solid cells of every layer at once
+		for (unsigned int x = 0; x < Search.Width; ++x) {
+			signed int elevation = map.Cell(x, y).Elevation;
+			if (elevation < Search.MinElevation) elevation = Search.MinElevation;
+			if (elevation > Search.MaxElevation) elevation = Search.MaxElevation;
+			++Histogram[elevation - Search.MinElevation];
+		}
+		if (!regions) continue;
+
+		// Only the runs of the row above are needed any more. The roots of
+		// their regions may be further up, so the first run of each region
+		// takes its place.
+		if (AboveBegin > 0) {
+			std::map<unsigned int, unsigned int> moved;
+			for (unsigned int r = AboveBegin; r < AboveEnd; ++r) {
+				unsigned int root = Root(r);
+				if (root >= AboveBegin) {
+					Parent[r] = root;
+					continue;
+				}
+				auto found = moved.find(root);
+				if (found == moved.end()) {
+					moved[root] = r;
+					Size[r] = Size[root];
+					Parent[r] = r;
+				} else {
+					Parent[r] = found->second;
+				}
+			}
+			unsigned int offset = AboveBegin;
+			Runs.erase(Runs.begin(), Runs.begin() + offset);
+			Parent.erase(Parent.begin(), Parent.begin() + offset);
+			Size.erase(Size.begin(), Size.begin() + offset);
+			for (unsigned int r = 0; r < Parent.size(); ++r) Parent[r] -= offset;
+			AboveBegin = 0;
+			AboveEnd -= offset;
+		}
+
+		unsigned int row_begin = Runs.size();
+		unsigned int above = AboveBegin;
+		for (unsigned int x = 0; x < Search.Width; ) {
+			signed int elevation = map.Cell(x, y).Elevation;
+			if (elevation < low || elevation >= high) {
+				++x;
+				continue;
+			}
+			Run run = { x, x + 1 };
+			while (run.XEnd < Search.Width) {
+				elevation = map.Cell(run.XEnd, y).Elevation;
+				if (elevation < low || elevation >= high) break;
+				++run.XEnd;
+			}
+			x = run.XEnd;
+
+			unsigned int r = Runs.size();
+			Runs.push_back(run);
+			Parent.push_back(r);
+			Size.push_back(run.XEnd - run.XBegin);
+
+			// The last run above that overlaps this one may overlap the next one too
+			while (above < AboveEnd && Runs[above].XEnd <= run.XBegin) ++above;
+			for (unsigned int a = above; a < AboveEnd && Runs[a].XBegin < run.XEnd; ++a) {
+				unsigned int root = Root(a);
+				unsigned int own = Root(r);
+				if (root == own) continue;
+				Parent[own] = root;
+				Size[root] += Size[own];
+			}
+			size_t region = Size[Root(r)];
+			if (region > Largest) Largest = region;
+		}
+		AboveBegin = row_begin;
+		AboveEnd = Runs.size();
+	}
+}
+
+bool SeedSearch::Measure::Finish(Stats & stats) {
+	stats.Solid.assign(Search.NumLayers, 0.0f);
+	stats.LargestRegion = Largest;
+
+	bool ok = true;
+	double cells = (double)Search.Width * Search.Height;
+	for (unsigned int l = 1; l + 1 < Search.NumLayers; ++l) {
+		signed int from = Search.Layers[l].Elevation - Search.MinElevation;
+		if (from < 0) from = 0;
+		size_t solid = 0;
+		for (unsigned int e = from; e < Histogram.size(); ++e) solid += Histogram[e];
+		stats.Solid[l] = solid / cells;
+		if (stats.Solid[l] < Search.MinSolid[l] || stats.Solid[l] > Search.MaxSolid[l]) ok = false;
+	}
+	return ok && Largest >= Search.MinRegion;
+}
+
+std::vector<uint32_t> SeedSearch::Find(unsigned int count, uint32_t first_seed, unsigned int max_tries) {
+	std::vector<uint32_t> seeds;
+	Tried = 0;
+	if (!count) return seeds;
+
+	// Each worker keeps a map of its own and takes the next seed until there
+	// are enough. Once count seeds have passed, the ones after the last of
+	// them aren't needed any more, but the ones before it still are, so that
+	// the result doesn't depend on the threads.
+	std::vector<unsigned int> passed;
+	std::mutex passed_lock;
+	std::atomic<unsigned int> next(0);
+	std::atomic<unsigned int> end(max_tries);
+
+	auto TrySeeds = [&](Map & candidate) {
+		Stats stats;
+		for (;;) {
+			unsigned int i = next++;
+			if (i >= end || Stopping) break;
+			Measure measure(*this);
+			candidate.Random(first_seed + i, [&](unsigned int y_begin, unsigned int y_end) {
+				measure.AddRows(candidate, y_begin, y_end);
+			});
+			++Tried;
+			if (!measure.Finish(stats)) continue;
+
+			std::lock_guard<std::mutex> lock(passed_lock);
+			passed.push_back(i);
+			if (passed.size() >= count) {
+				std::nth_element(passed.begin(), passed.begin() + count - 1, passed.end());
+				if (passed[count - 1] + 1 < end) end = passed[count - 1] + 1;
+			}
+		}
+	};
+
+	Map::CellLayout layout = Blocks ? Map::LAYOUT_BLOCKS : Map::LAYOUT_ROWS;
+	if (!BackingFile.empty()) {
+		// A map that needs a file won't fit in memory twice either
+		Map candidate(Width, Height, MinElevation, MaxElevation, layout, BackingFile.c_str());
+		candidate.SetStripeRows(StripeRows);
+		TrySeeds(candidate);
+	} else {
+		ThreadPool & pool = ThreadPool::Instance();
+		pool.ParallelFor(0, pool.NumThreads(), 1, [&](unsigned int, unsigned int) {
+			Map candidate(Width, Height, MinElevation, MaxElevation, layout);
+			candidate.SetStripeRows(StripeRows);
+			TrySeeds(candidate);
+		});
+	}
+
+	std::sort(passed.begin(), passed.end());
+	if (passed.size() > count) passed.resize(count);
+	for (unsigned int i = 0; i < passed.size(); ++i) {
+		seeds.push_back(first_seed + passed[i]);
+	}
+	return seeds;
+}
@@ -0,0 +1,132 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SEEDSEARCH_H_E5C07B3A_4F3B_11E3_B1D8_525400DA3F0D
+#define SEEDSEARCH_H_E5C07B3A_4F3B_11E3_B1D8_525400DA3F0D
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Map;
+struct MapLayer;
+
+// Looks for the seeds of maps that meet some constraints, checked on the
+// blurred elevation alone, so that the maps that don't are thrown away before
+// any tile is solved. A cell is solid in a layer when it is at or above the
+// elevation of the layer, like the tiles the solver picks for it.
+class SeedSearch {
+public:
+	struct Stats {
+		std::vector<float> Solid; // Fraction of solid cells, for each layer
+		size_t LargestRegion;     // Cells, 0 if it wasn't needed
+	};
+
+	// Candidates of the size, elevation range, layers, layout and stripes of
+	// the map. The regions are looked for in its starting layer. With a
+	// backing file, the cells of the candidates are mapped from it like the
+	// ones of the map, and only one candidate is kept at a time.
+	SeedSearch(const Map & map, const char * backing_file = NULL);
+
+	// Fraction of the cells of the map that have to be solid in the layer,
+	// an index into the layers of the map
+	void SetSolidFraction(unsigned int layer, float min, float max);
+
+	// Cells in the largest area of ground of the starting layer, the cells
+	// that are solid in it but not in the next one, that touch each other
+	// horizontally or vertically
+	void SetMinRegion(size_t cells);
+
+	// Measures a map row after row, in order, as Map::Random or Map::Import
+	// makes them final, so that a mapped map isn't read again all over
+	class Measure {
+	public:
+		Measure(const SeedSearch & search);
+
+		void AddRows(const Map & map, unsigned int y_begin, unsigned int y_end);
+
+		// Whether the map meets the constraints, once all its rows are in
+		bool Finish(Stats & stats);
+
+	private:
+		// Runs of ground cells in each row, joined with the ones they touch
+		// in the row above with a union-find whose roots keep the size of
+		// their region
+		struct Run {
+			unsigned int XBegin;
+			unsigned int XEnd;
+		};
+
+		unsigned int Root(unsigned int r);
+
+		const SeedSearch & Search;
+		std::vector<size_t> Histogram; // Cells of each elevation
+		std::vector<Run> Runs;
+		std::vector<unsigned int> Parent;
+		std::vector<size_t> Size;
+		unsigned int AboveBegin;       // Runs of the last row added
+		unsigned int AboveEnd;
+		size_t Largest;
+	};
+
+
+	// Tries the seeds first_seed, first_seed + 1... in parallel, at most
+	// max_tries of them, and returns the first count that pass, in order.
+	// With a backing file, they are tried one after another instead, each
+	// of them blurred in parallel.
+	std::vector<uint32_t> Find(unsigned int count, uint32_t first_seed, unsigned int max_tries);
+
+	// Tries made by the last Find
+	inline unsigned int Tries() const {
+		return Tried;
+	}
+
+	// Makes Find give up as soon as it can, with the seeds found so far
+	inline void Stop() {
+		Stopping = true;
+	}
+
+private:
+
+	unsigned int Width;
+	unsigned int Height;
+	signed int MinElevation;
+	signed int MaxElevation;
+	bool Blocks;               // Whether the cells are laid out in blocks
+	unsigned int StripeRows;
+	std::string BackingFile;   // Empty for candidates in memory
+	const MapLayer * Layers;
+	unsigned int NumLayers;    // Counting the sentinels at both ends
+	unsigned int WalkLayer;
+	std::vector<float> MinSolid;
+	std::vector<float> MaxSolid;
+	size_t MinRegion;
+	std::atomic<unsigned int> Tried;
+	std::atomic<bool> Stopping;
+};
+
+#endif // SEEDSEARCH_H_E5C07B3A_4F3B_11E3_B1D8_525400DA3F0D
@@ -0,0 +1,133 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Run from the top directory, with make check
+
+#include "../collision.h"
+#include "../map.h"
+#include "../pathfinder.h"
+#include "../tileset.h"
+
+#include <cstdio>
+#include <random>
+
+static unsigned int Failures = 0;
+
+static void Check(bool ok, const char * what) {
+	if (ok) return;
+	printf("FAILED: %s\n", what);
+	++Failures;
+}
+
+static bool SameGrid(const CollisionGrid & a, const CollisionGrid & b) {
+	if (a.Width() != b.Width() || a.Height() != b.Height() || a.NumRegions() != b.NumRegions()) return false;
+	for (unsigned int r = 1; r <= a.NumRegions(); ++r) {
+		if (a.RegionSize(r) != b.RegionSize(r)) return false;
+	}
+	for (unsigned int y = 0; y < a.Height(); ++y) {
+		for (unsigned int x = 0; x < a.Width(); ++x) {
+			if (a.Blocked(x, y) != b.Blocked(x, y) || a.Region(x, y) != b.Region(x, y)) return false;
+		}
+	}
+	return true;
+}
+
+// The same paths, between the same random points, as long as both ends are free
+static bool SamePaths(PathFinder & a, PathFinder & b, const CollisionGrid & grid, uint32_t seed) {
+	std::minstd_rand rng(seed);
+	std::vector<PathFinder::Point> path_a, path_b;
+	for (unsigned int tries = 0, found = 0; tries < 2000 && found < 200; ++tries) {
+		PathFinder::Point from = { (unsigned int)(rng() % grid.Width()), (unsigned int)(rng() % grid.Height()) };
+		PathFinder::Point to = { (unsigned int)(rng() % grid.Width()), (unsigned int)(rng() % grid.Height()) };
+		if (grid.Blocked(from.X, from.Y) || grid.Blocked(to.X, to.Y)) continue;
+		unsigned int cost_a = 0, cost_b = 0;
+		bool found_a = a.FindPath(from, to, path_a, &cost_a);
+		bool found_b = b.FindPath(from, to, path_b, &cost_b);
+		if (found_a != found_b || cost_a != cost_b || path_a.size() != path_b.size()) return false;
+		for (unsigned int i = 0; i < path_a.size(); ++i) {
+			if (path_a[i].X != path_b[i].X || path_a[i].Y != path_b[i].Y) return false;
+		}
+		if (found_a) ++found;
+	}
+	return true;
+}
+
+// A region of a solved map is solved again, here taken from a map solved
+// from another seed, and the grid and the path finder are updated for it.
+// The rectangles cross the borders of the clusters and of the bands of the
+// grid, and the edges of the map.
+static void TestUpdate() {
+	TileSet tiles1, tiles2, tiles3;
+	MapLayer layers[] = { { NULL, VERY_LOW }, { &tiles1, -4 }, { &tiles2, 0 }, { &tiles3, 8 }, { NULL, VERY_HIGH } };
+	const unsigned int size = 72;
+	const unsigned int resolution = 4;
+	Map map(size, size, -100, 100);
+	map.SetLayers(layers);
+	map.SetStartingLayer(2);
+	map.Random(1);
+	map.AddTiles();
+	Map other(size, size, -100, 100);
+	other.SetLayers(layers);
+	other.SetStartingLayer(2);
+	other.Random(2);
+	other.AddTiles();
+
+	CollisionGrid grid;
+	PathFinder paths;
+	grid.Build(map, resolution, 2);
+	paths.Build(grid, 16);
+
+	const unsigned int rects[][4] = {
+		{ 20, 50, 45, 70 }, // Across the bands
+		{ 0, 0, 9, 5 },     // At the corner of the map
+		{ 33, 10, 34, 11 }, // A single tile
+		{ 60, 30, 72, 72 }, // At the right and bottom edges
+	};
+	for (unsigned int r = 0; r < sizeof(rects) / sizeof(rects[0]); ++r) {
+		const unsigned int * rect = rects[r];
+		for (unsigned int y = rect[1]; y < rect[3]; ++y) {
+			for (unsigned int x = rect[0]; x < rect[2]; ++x) {
+				map.Cell(x, y).TileRuntimeData = other.Cell(x, y).TileRuntimeData;
+			}
+		}
+		grid.Update(map, rect[0], rect[1], rect[2], rect[3]);
+		paths.Update(rect[0] * resolution, rect[1] * resolution, rect[2] * resolution, rect[3] * resolution);
+
+		CollisionGrid fresh_grid;
+		PathFinder fresh_paths;
+		fresh_grid.Build(map, resolution, 2);
+		fresh_paths.Build(fresh_grid, 16);
+		Check(SameGrid(grid, fresh_grid), "the updated grid is the same as a new one");
+		Check(paths.NumNodes() == fresh_paths.NumNodes(), "the updated path finder has the same entrances");
+		Check(SamePaths(paths, fresh_paths, grid, r + 1), "the updated path finder finds the same paths");
+	}
+}
+
+int main() {
+	TestUpdate();
+	if (Failures) return 1;
+	printf("pathfinder_test: OK\n");
+	return 0;
+}
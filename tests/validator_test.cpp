@@ -0,0 +1,87 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Run from the top directory, with make check
+
+#include "../map.h"
+#include "../tileset.h"
+#include "../validator.h"
+
+#include <cstdio>
+
+static unsigned int Failures = 0;
+
+static void Check(bool ok, const char * what) {
+	if (ok) return;
+	printf("FAILED: %s\n", what);
+	++Failures;
+}
+
+// Solid and empty tiles in a checkerboard: every pair of neighbours is a
+// conflict, far more of them than are kept, in every band of rows
+static void TestLocationsCap() {
+	TileSet tiles;
+	MapLayer layers[] = { { NULL, VERY_LOW }, { &tiles, 0 }, { NULL, VERY_HIGH } };
+	const unsigned int width = 200;
+	const unsigned int height = 100;
+	Map map(width, height, -100, 100);
+	map.SetLayers(layers);
+	for (unsigned int y = 0; y < height; ++y) {
+		for (unsigned int x = 0; x < width; ++x) {
+			unsigned int tile = (x + y) % 2 ? tiles.SolidTile() : tiles.EmptyTile();
+			map.Cell(x, y).TileRuntimeData = &tiles.GetTileRuntimeData(tile);
+		}
+	}
+
+	MapValidator validator(map);
+	unsigned int conflicts = validator.Validate();
+	unsigned int expected = (width - 1) * height + width * (height - 1);
+	Check(conflicts == expected, "every pair of neighbours is counted");
+	Check(validator.NumConflicts() == conflicts, "NumConflicts matches Validate");
+	Check(validator.Locations().size() == MapValidator::MAX_LOCATIONS, "exactly MAX_LOCATIONS are kept");
+
+	// The first ones, row after row, the one to the right before the one below
+	unsigned int i = 0;
+	for (unsigned int y = 0; y < height && i < validator.Locations().size(); ++y) {
+		for (unsigned int x = 0; x < width && i < validator.Locations().size(); ++x) {
+			for (unsigned int vertical = 0; vertical < 2 && i < validator.Locations().size(); ++vertical) {
+				if (!vertical && x + 1 == width) continue;
+				if (vertical && y + 1 == height) continue;
+				const MapValidator::Conflict & conflict = validator.Locations()[i++];
+				if (conflict.X != x || conflict.Y != y || conflict.Vertical != (vertical != 0)) {
+					Check(false, "the first conflicts are kept, in order");
+					return;
+				}
+			}
+		}
+	}
+}
+
+int main() {
+	TestLocationsCap();
+	if (Failures) return 1;
+	printf("validator_test: OK\n");
+	return 0;
+}
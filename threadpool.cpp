@@ -0,0 +1,209 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "threadpool.h"
+
+// Worker of which pool, if any, is running in the current thread
+static thread_local ThreadPool * CurrentPool = NULL;
+static thread_local int CurrentWorker = -1;
+
+ThreadPool::ThreadPool(unsigned int num_threads) :
+		Queued(0),
+		NextQueue(0),
+		Stop(false) {
+	if (num_threads == 0) num_threads = 1;
+	for (unsigned int i = 0; i < num_threads; ++i) {
+		Workers.push_back(new Worker);
+	}
+	for (unsigned int i = 0; i < num_threads; ++i) {
+		Workers[i]->Thread = std::thread(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(SleepLock);
+		Stop = true;
+	}
+	WakeUp.notify_all();
+	for (unsigned int i = 0; i < Workers.size(); ++i) {
+		Workers[i]->Thread.join();
+		delete Workers[i];
+	}
+}
+
+ThreadPool & ThreadPool::Instance() {
+	static ThreadPool pool(std::thread::hardware_concurrency());
+	return pool;
+}
+
+void ThreadPool::Push(Job * job) {
+	// Workers keep what they spawn, other threads spread it around
+	unsigned int queue;
+	if (CurrentPool == this) {
+		queue = CurrentWorker;
+	} else {
+		queue = NextQueue++ % Workers.size();
+	}
+	{
+		std::lock_guard<std::mutex> lock(Workers[queue]->Lock);
+		Workers[queue]->Jobs.push_back(job);
+	}
+	++Queued;
+	{
+		std::lock_guard<std::mutex> lock(SleepLock);
+	}
+	WakeUp.notify_one();
+	Finished.notify_all();
+}
+
+ThreadPool::Job * ThreadPool::Pop() {
+	int self = CurrentPool == this ? CurrentWorker : -1;
+	unsigned int n = Workers.size();
+
+	if (self >= 0) {
+		std::lock_guard<std::mutex> lock(Workers[self]->Lock);
+		if (!Workers[self]->Jobs.empty()) {
+			Job * job = Workers[self]->Jobs.back();
+			Workers[self]->Jobs.pop_back();
+			--Queued;
+			return job;
+		}
+	}
+
+	unsigned int start = self >= 0 ? self + 1 : NextQueue.load();
+	for (unsigned int i = 0; i < n; ++i) {
+		unsigned int victim = (start + i) % n;
+		if ((int)victim == self) continue;
+		std::lock_guard<std::mutex> lock(Workers[victim]->Lock);
+		if (!Workers[victim]->Jobs.empty()) {
+			Job * job = Workers[victim]->Jobs.front();
+			Workers[victim]->Jobs.pop_front();
+			--Queued;
+			return job;
+		}
+	}
+	return NULL;
+}
+
+bool ThreadPool::RunOne() {
+	Job * job = Pop();
+	if (!job) return false;
+	job->Run();
+	TaskGroup * group = job->Group;
+	delete job;
+	if (--group->Pending == 0) { // The group may be gone right after this
+		{
+			std::lock_guard<std::mutex> lock(SleepLock);
+		}
+		Finished.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::WorkerLoop(unsigned int index) {
+	CurrentPool = this;
+	CurrentWorker = index;
+	for (;;) {
+		if (RunOne()) continue;
+		std::unique_lock<std::mutex> lock(SleepLock);
+		WakeUp.wait(lock, [this] { return Stop || Queued > 0; });
+		if (Stop && Queued == 0) return;
+	}
+}
+
+void ThreadPool::ParallelFor(unsigned int begin, unsigned int end, unsigned int grain, const RangeTask & body) {
+	if (end <= begin) return;
+	if (grain == 0) grain = 1;
+
+	// A few chunks per thread, so that stealing can even out the load
+	unsigned int count = end - begin;
+	unsigned int chunks = (count + grain - 1) / grain;
+	if (chunks > NumThreads() * 4) chunks = NumThreads() * 4;
+	if (chunks <= 1) {
+		body(begin, end);
+		return;
+	}
+	unsigned int size = (count + chunks - 1) / chunks;
+
+	TaskGroup group(*this);
+	for (unsigned int b = begin + size; b < end; b += size) {
+		unsigned int e = b + size < end ? b + size : end;
+		group.Run([&body, b, e] { body(b, e); });
+	}
+	body(begin, begin + size);
+	group.Wait();
+}
+
+void TaskGroup::Run(const ThreadPool::Task & task) {
+	++Pending;
+	ThreadPool::Job * job = new ThreadPool::Job;
+	job->Run = task;
+	job->Group = this;
+	Pool.Push(job);
+}
+
+void TaskGroup::Wait() {
+	while (Pending > 0) {
+		if (Pool.RunOne()) continue;
+		std::unique_lock<std::mutex> lock(Pool.SleepLock);
+		Pool.Finished.wait(lock, [this] { return Pending == 0 || Pool.Queued > 0; });
+	}
+}
+
+unsigned int TaskGraph::Add(const ThreadPool::Task & task) {
+	Nodes.emplace_back();
+	Node & node = Nodes.back();
+	node.Run = task;
+	node.Predecessors = 0;
+	return Nodes.size() - 1;
+}
+
+void TaskGraph::Precede(unsigned int before, unsigned int after) {
+	Nodes[before].Successors.push_back(after);
+	++Nodes[after].Predecessors;
+}
+
+void TaskGraph::Launch(TaskGroup & group, unsigned int index) {
+	group.Run([this, &group, index] {
+		Node & node = Nodes[index];
+		node.Run();
+		for (unsigned int i = 0; i < node.Successors.size(); ++i) {
+			unsigned int next = node.Successors[i];
+			if (--Nodes[next].Remaining == 0) Launch(group, next);
+		}
+	});
+}
+
+void TaskGraph::Run(ThreadPool & pool) {
+	TaskGroup group(pool);
+	for (unsigned int i = 0; i < Nodes.size(); ++i) {
+		Nodes[i].Remaining = Nodes[i].Predecessors;
+	}
+	for (unsigned int i = 0; i < Nodes.size(); ++i) {
+		if (Nodes[i].Predecessors == 0) Launch(group, i);
+	}
+	group.Wait();
+}
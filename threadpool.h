@@ -0,0 +1,135 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef THREADPOOL_H_1E6F3B2A_4E41_11E3_B7C2_525400DA3F0D
+#define THREADPOOL_H_1E6F3B2A_4E41_11E3_B7C2_525400DA3F0D
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+// Work-stealing thread pool. Each worker keeps its own queue of tasks: it
+// takes the newest ones from it and, when it runs out, steals the oldest ones
+// from the others. Threads waiting for a TaskGroup keep running tasks in the
+// meantime, so stages can be nested without blocking the pool.
+class ThreadPool {
+public:
+	typedef std::function<void()> Task;
+	typedef std::function<void(unsigned int begin, unsigned int end)> RangeTask;
+
+	explicit ThreadPool(unsigned int num_threads);
+	~ThreadPool();
+
+	// Pool sized to the machine, shared by every map
+	static ThreadPool & Instance();
+
+	inline unsigned int NumThreads() const {
+		return Workers.size();
+	}
+
+	// Runs body over [begin, end), split into chunks of at least grain
+	// elements, and returns once all of them are done.
+	void ParallelFor(unsigned int begin, unsigned int end, unsigned int grain, const RangeTask & body);
+
+private:
+	friend class TaskGroup;
+
+	struct Job {
+		Task Run;
+		TaskGroup * Group;
+	};
+
+	struct Worker {
+		std::mutex Lock;
+		std::deque<Job *> Jobs;
+		std::thread Thread;
+	};
+
+	void Push(Job * job);
+	Job * Pop();
+	bool RunOne();
+	void WorkerLoop(unsigned int index);
+
+	std::vector<Worker *> Workers;
+	std::atomic<unsigned int> Queued;
+	std::atomic<unsigned int> NextQueue;
+	std::mutex SleepLock;
+	std::condition_variable WakeUp;   // Workers, for new tasks
+	std::condition_variable Finished; // Waiting threads, for new tasks or finished groups
+	bool Stop;
+};
+
+// Tasks that are waited for together
+class TaskGroup {
+public:
+	TaskGroup(ThreadPool & pool) : Pool(pool), Pending(0) {
+	}
+
+	~TaskGroup() {
+		Wait();
+	}
+
+	void Run(const ThreadPool::Task & task);
+
+	// Runs queued tasks until all the tasks of the group are finished, and
+	// sleeps while the last ones are run by other threads
+	void Wait();
+
+private:
+	friend class ThreadPool;
+
+	ThreadPool & Pool;
+	std::atomic<unsigned int> Pending;
+};
+
+// Tasks with dependencies: each one is run once all of its predecessors are done
+class TaskGraph {
+public:
+	unsigned int Add(const ThreadPool::Task & task);
+	void Precede(unsigned int before, unsigned int after);
+
+	// Runs the whole graph and waits for it
+	void Run(ThreadPool & pool);
+
+private:
+	struct Node {
+		ThreadPool::Task Run;
+		std::vector<unsigned int> Successors;
+		unsigned int Predecessors;
+		std::atomic<unsigned int> Remaining;
+	};
+
+	void Launch(TaskGroup & group, unsigned int index);
+
+	std::deque<Node> Nodes;
+};
+
+#endif // THREADPOOL_H_1E6F3B2A_4E41_11E3_B7C2_525400DA3F0D
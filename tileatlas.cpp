@@ -0,0 +1,220 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "tileatlas.h"
+#include "tileset.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char TileCacheMagic[4] = { 'T', 'A', 'C', '1' };
+
+// Magic, then NumTiles, TileWidth, TileHeight, Columns, Width, Height and the
+// signature of the images, then the RGBA pixels of the whole atlas
+static const size_t TileCacheHeader = sizeof(TileCacheMagic) + 7 * sizeof(uint32_t);
+
+static inline uint32_t HashBytes(uint32_t hash, const void * data, size_t size) {
+	const unsigned char * bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+TileAtlas::TileAtlas() :
+		NumTiles(0),
+		TileWidth(0),
+		TileHeight(0),
+		Columns(0),
+		Width(0),
+		Height(0) {
+}
+
+void TileAtlas::Add(ITileSet & tiles, const char * base_dir) {
+	tiles.SetBaseDirectory(base_dir);
+	Source source = { &tiles, base_dir };
+	Sources.push_back(source);
+}
+
+// Names, sizes and modification times of all the images, in order
+bool TileAtlas::Sign(uint32_t & signature) const {
+	signature = 2166136261u;
+	uint32_t padding = PADDING;
+	signature = HashBytes(signature, &padding, sizeof(padding));
+	for (unsigned int s = 0; s < Sources.size(); ++s) {
+		const ITileSet * tiles = Sources[s].Tiles;
+		for (unsigned int i = 0; i < tiles->NumTiles(); ++i) {
+			std::string filename = Sources[s].BaseDir + "/" + tiles->BaseFileName(i);
+			struct stat st;
+			if (stat(filename.c_str(), &st) != 0) {
+				printf("Unable to find '%s'\n", filename.c_str());
+				return false;
+			}
+			int64_t times[3] = { (int64_t)st.st_size, (int64_t)st.st_mtim.tv_sec, (int64_t)st.st_mtim.tv_nsec };
+			signature = HashBytes(signature, filename.c_str(), filename.size() + 1);
+			signature = HashBytes(signature, times, sizeof(times));
+		}
+	}
+	return true;
+}
+
+bool TileAtlas::LoadCache(const char * filename, uint32_t signature) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	void * data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= TileCacheHeader) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (data == MAP_FAILED) {
+		printf("Ignoring tile cache '%s'\n", filename);
+		return false;
+	}
+
+	const char * magic = (const char *)data;
+	uint32_t header[7];
+	memcpy(header, magic + sizeof(TileCacheMagic), sizeof(header));
+	bool ok = memcmp(magic, TileCacheMagic, sizeof(TileCacheMagic)) == 0 &&
+		header[0] == NumTiles && header[6] == signature &&
+		header[1] > 0 && header[2] > 0 && header[3] > 0 &&
+		header[4] == header[3] * (header[1] + 2*PADDING) &&
+		header[5] == (NumTiles + header[3] - 1) / header[3] * (header[2] + 2*PADDING) &&
+		(size_t)st.st_size == TileCacheHeader + (size_t)header[4] * header[5] * 4;
+	if (ok) {
+		TileWidth = header[1];
+		TileHeight = header[2];
+		Columns = header[3];
+		Width = header[4];
+		Height = header[5];
+		// The whole atlas goes to the graphics card at once, straight from the file
+		ok = Atlas.create(Width, Height);
+		if (ok) Atlas.update((const sf::Uint8 *)data + TileCacheHeader);
+	}
+	munmap(data, st.st_size);
+
+	if (!ok) printf("Ignoring tile cache '%s'\n", filename);
+	return ok;
+}
+
+bool TileAtlas::SaveCache(const char * filename, uint32_t signature, const sf::Uint8 * pixels) const {
+	// Written aside and renamed, so that no other process maps half a cache
+	std::string temp = std::string(filename) + ".tmp";
+	FILE * f = fopen(temp.c_str(), "wb");
+	if (!f) return false;
+
+	uint32_t header[7] = { NumTiles, TileWidth, TileHeight, Columns, Width, Height, signature };
+	bool ok = fwrite(TileCacheMagic, sizeof(TileCacheMagic), 1, f) == 1 &&
+		fwrite(header, sizeof(header), 1, f) == 1 &&
+		fwrite(pixels, (size_t)Width * Height * 4, 1, f) == 1;
+	ok = fclose(f) == 0 && ok;
+	ok = ok && rename(temp.c_str(), filename) == 0;
+	if (!ok) remove(temp.c_str());
+	return ok;
+}
+
+bool TileAtlas::Decode(std::vector<sf::Uint8> & pixels) {
+	sf::Image image;
+	unsigned int tile = 0;
+	for (unsigned int s = 0; s < Sources.size(); ++s) {
+		const ITileSet * tiles = Sources[s].Tiles;
+		for (unsigned int i = 0; i < tiles->NumTiles(); ++i, ++tile) {
+			std::string filename = Sources[s].BaseDir + "/" + tiles->BaseFileName(i);
+			if (!image.loadFromFile(filename)) return false;
+			sf::Vector2u size = image.getSize();
+
+			// Every tile is the size of the first one
+			if (tile == 0) {
+				TileWidth = size.x;
+				TileHeight = size.y;
+				Columns = ceil(sqrt((double)NumTiles));
+				Width = Columns * (TileWidth + 2*PADDING);
+				Height = (NumTiles + Columns - 1) / Columns * (TileHeight + 2*PADDING);
+				pixels.assign((size_t)Width * Height * 4, 0);
+			} else if (size.x != TileWidth || size.y != TileHeight) {
+				printf("'%s' isn't %ux%u like the other tiles\n", filename.c_str(), TileWidth, TileHeight);
+				return false;
+			}
+
+			// The padding repeats the nearest pixel of the tile
+			const sf::Uint8 * source = image.getPixelsPtr();
+			unsigned int x0 = tile % Columns * (TileWidth + 2*PADDING);
+			unsigned int y0 = tile / Columns * (TileHeight + 2*PADDING);
+			for (unsigned int y = 0; y < TileHeight + 2*PADDING; ++y) {
+				unsigned int sy = y < PADDING ? 0 : y - PADDING < TileHeight ? y - PADDING : TileHeight - 1;
+				sf::Uint8 * out = &pixels[((size_t)(y0 + y) * Width + x0) * 4];
+				for (unsigned int x = 0; x < TileWidth + 2*PADDING; ++x) {
+					unsigned int sx = x < PADDING ? 0 : x - PADDING < TileWidth ? x - PADDING : TileWidth - 1;
+					memcpy(out + x * 4, source + ((size_t)sy * TileWidth + sx) * 4, 4);
+				}
+			}
+		}
+	}
+	return tile > 0;
+}
+
+void TileAtlas::SetSprites() {
+	unsigned int tile = 0;
+	for (unsigned int s = 0; s < Sources.size(); ++s) {
+		ITileSet * tiles = Sources[s].Tiles;
+		for (unsigned int i = 0; i < tiles->NumTiles(); ++i, ++tile) {
+			sf::IntRect rect(
+				tile % Columns * (TileWidth + 2*PADDING) + PADDING,
+				tile / Columns * (TileHeight + 2*PADDING) + PADDING,
+				TileWidth, TileHeight);
+			tiles->GetSprite(i) = sf::Sprite(Atlas, rect);
+		}
+	}
+}
+
+bool TileAtlas::Load(const char * cache_file) {
+	NumTiles = 0;
+	for (unsigned int s = 0; s < Sources.size(); ++s) {
+		NumTiles += Sources[s].Tiles->NumTiles();
+	}
+
+	uint32_t signature;
+	if (!Sign(signature)) return false;
+
+	if (!LoadCache(cache_file, signature)) {
+		printf("Decoding %u tile images\n", NumTiles);
+		std::vector<sf::Uint8> pixels;
+		if (!Decode(pixels) || !Atlas.create(Width, Height)) return false;
+		Atlas.update(&pixels[0]);
+		if (!SaveCache(cache_file, signature, &pixels[0]))
+			printf("Unable to save tile cache '%s'\n", cache_file);
+	}
+
+	Atlas.setSmooth(false);
+	SetSprites();
+	return true;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef TILEATLAS_H_8D4A2F76_4F3B_11E3_BE52_525400DA3F0D
+#define TILEATLAS_H_8D4A2F76_4F3B_11E3_BE52_525400DA3F0D
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ITileSet;
+
+// The tiles of several tile sets packed into a single texture, and the sprite
+// of each tile pointing into it. The decoded pixels are kept in a binary cache
+// file, only accepted if every tile image still has the same size and
+// modification time, so that the images are only decoded when they change.
+class TileAtlas {
+public:
+	enum {
+		// Each tile is surrounded by a copy of its edge pixels, so that the
+		// tiles next to it never bleed into it when it's scaled
+		PADDING = 1,
+	};
+
+	TileAtlas();
+
+	// Tile set whose images are in base_dir, loaded along with the others
+	void Add(ITileSet & tiles, const char * base_dir);
+
+	// Loads the tiles of every tile set added, and sets up their sprites.
+	// The cache file is rebuilt if it doesn't match the images.
+	bool Load(const char * cache_file);
+
+	inline const sf::Texture & Texture() const {
+		return Atlas;
+	}
+
+private:
+	struct Source {
+		ITileSet * Tiles;
+		std::string BaseDir;
+	};
+
+	bool Sign(uint32_t & signature) const;
+	bool LoadCache(const char * filename, uint32_t signature);
+	bool SaveCache(const char * filename, uint32_t signature, const sf::Uint8 * pixels) const;
+	bool Decode(std::vector<sf::Uint8> & pixels);
+	void SetSprites();
+
+	std::vector<Source> Sources;
+	sf::Texture Atlas;
+	unsigned int NumTiles;
+	unsigned int TileWidth;
+	unsigned int TileHeight;
+	unsigned int Columns;
+	unsigned int Width;
+	unsigned int Height;
+};
+
+#endif // TILEATLAS_H_8D4A2F76_4F3B_11E3_BE52_525400DA3F0D
@@ -34,21 +34,6 @@
 #include <cmath>
 #include <climits>
 
-bool ITileSet::LoadTileTextures(const char * base_dir) {
-	for (unsigned int i = 0; i < NumTiles(); ++i) {
-		char filename[32];
-		snprintf(filename, sizeof(filename), "%s/%s", base_dir, BaseFileName(i));
-		printf("Loading '%s'\n", filename);
-		if (!TileRuntimeData[i].Texture.loadFromFile(filename)) {
-			return false;
-		}
-		TileRuntimeData[i].Texture.setSmooth(false);
-		TileRuntimeData[i].Sprite = sf::Sprite(TileRuntimeData[i].Texture);
-	}
-	return true;
-}
-
-
 const TileSet::TileConfig TileSet::TileData_Config[] = {
 	// FileName         SolidFlags          EdgeUp       EdgeDown     EdgeLeft     EdgeRight    Fill
 	{ "A1.png",  BE+BEU+BED+BER+BEL, EMPTY,       EMPTY,       EMPTY,       EMPTY       ,   0 }, // 00 " "
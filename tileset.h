@@ -28,6 +28,9 @@
 
 #include <SFML/Graphics.hpp>
 #include <SFML/System.hpp>
+#include <string>
+
+class PatternCache;
 
 class ITileSet {
 public:
@@ -42,18 +45,24 @@ public:
 	};
 
 	struct TileRuntime {
-		sf::Texture Texture;
-		sf::Sprite Sprite;
+		sf::Sprite Sprite;      // Part of the TileAtlas its images were loaded into
+		const ITileSet * Owner; // Tile set and index of the tile
+		unsigned int Index;
 	};
 
 	ITileSet(const TileConfig * config_data) :
 			NumberOfTiles(0),
 			TileConfigData(config_data),
-			TileRuntimeData(NULL) {
+			TileRuntimeData(NULL),
+			Patterns(NULL) {
 		for (const TileConfig * tile = config_data; tile->FileName != NULL; ++tile) {
 			++NumberOfTiles;
 		}
 		TileRuntimeData = new TileRuntime[NumberOfTiles];
+		for (unsigned int i = 0; i < NumberOfTiles; ++i) {
+			TileRuntimeData[i].Owner = this;
+			TileRuntimeData[i].Index = i;
+		}
 	}
 
 	virtual ~ITileSet() {
@@ -76,8 +85,21 @@ public:
 	// 0b(ul)(u)(ur)(l)(c)(r)(dl)(d)(dr)
 	virtual unsigned int InitialTileGuess(uint32_t env) const = 0;
 
-	// Load the sprite images and create the sprites
-	bool LoadTileTextures(const char * base_dir);
+	// Directory the sprite images are loaded from, by a TileAtlas
+	inline void SetBaseDirectory(const char * base_dir) {
+		BaseDir = base_dir;
+	}
+	inline const char * BaseDirectory() const {
+		return BaseDir.c_str();
+	}
+
+	// Pre-solved initial tiles, used instead of InitialTileGuess when set
+	inline void SetPatternCache(const PatternCache * patterns) {
+		Patterns = patterns;
+	}
+	inline const PatternCache * GetPatternCache() const {
+		return Patterns;
+	}
 
 	inline unsigned int NumTiles() const {
 		return NumberOfTiles;
@@ -109,9 +131,6 @@ public:
 	inline TileRuntime & GetTileRuntimeData(unsigned int index) {
 		return TileRuntimeData[index];
 	}
-	inline sf::Texture & GetTexture(unsigned int index) {
-		return TileRuntimeData[index].Texture;
-	}
 	inline sf::Sprite & GetSprite(unsigned int index) {
 		return TileRuntimeData[index].Sprite;
 	}
@@ -120,6 +139,8 @@ protected:
 	unsigned int NumberOfTiles;
 	const TileConfig * TileConfigData;
 	TileRuntime * TileRuntimeData;
+	const PatternCache * Patterns;
+	std::string BaseDir;
 };
 
 class TileSet : public ITileSet {
@@ -0,0 +1,226 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "validator.h"
+#include "map.h"
+
+#include <algorithm>
+
+// Edges of a pair of tiles of the same layer, a on the left of or above b
+static inline bool EdgesMatch(const ITileSet * tiles, bool vertical, unsigned int a, unsigned int b) {
+	if (vertical) return tiles->EdgesMatchError(tiles->EdgeDown(a), tiles->EdgeUp(b)) == 0;
+	return tiles->EdgesMatchError(tiles->EdgeRight(a), tiles->EdgeLeft(b)) == 0;
+}
+
+// Only the first MAX_LOCATIONS of them are kept, wherever they come from
+static inline void KeepLocation(std::vector<MapValidator::Conflict> & conflicts, unsigned int x, unsigned int y,
+		bool vertical) {
+	if (conflicts.size() >= MapValidator::MAX_LOCATIONS) return;
+	MapValidator::Conflict conflict = { x, y, vertical };
+	conflicts.push_back(conflict);
+}
+
+MapValidator::MapValidator(const Map & map) :
+		TheMap(map),
+		NumTiles(1),
+		Count(0),
+		HeatmapScale(1),
+		HeatmapWidth(0),
+		HeatmapHeight(0),
+		Stopping(false) {
+	for (unsigned int i = 1; map.Layers[i].Tiles != NULL; ++i) {
+		LayerTiles.push_back(map.Layers[i].Tiles);
+		FirstTile.push_back(NumTiles);
+		NumTiles += map.Layers[i].Tiles->NumTiles();
+	}
+
+	// Whether each pair of tiles can be next to each other, worked out once
+	// so that the scan is just a lookup for each pair
+	MatchH.assign(NumTiles * NumTiles, 1);
+	MatchV.assign(NumTiles * NumTiles, 1);
+	for (unsigned int la = 0; la < LayerTiles.size(); ++la) {
+		const ITileSet * tiles_a = LayerTiles[la];
+		for (unsigned int lb = 0; lb < LayerTiles.size(); ++lb) {
+			const ITileSet * tiles_b = LayerTiles[lb];
+			for (unsigned int a = 0; a < tiles_a->NumTiles(); ++a) {
+				for (unsigned int b = 0; b < tiles_b->NumTiles(); ++b) {
+					unsigned int index = (FirstTile[la] + a) * NumTiles + FirstTile[lb] + b;
+					for (unsigned int vertical = 0; vertical < 2; ++vertical) {
+						bool match;
+						if (la == lb) {
+							match = EdgesMatch(tiles_a, vertical, a, b);
+						} else if (la + 1 == lb) {
+							// b is solid in the layer of a, and a empty in the layer of b
+							match = EdgesMatch(tiles_a, vertical, a, tiles_a->SolidTile()) &&
+								EdgesMatch(tiles_b, vertical, tiles_b->EmptyTile(), b);
+						} else if (lb + 1 == la) {
+							match = EdgesMatch(tiles_b, vertical, tiles_b->SolidTile(), b) &&
+								EdgesMatch(tiles_a, vertical, a, tiles_a->EmptyTile());
+						} else {
+							// Solid next to empty in the layers in between
+							match = false;
+						}
+						(vertical ? MatchV : MatchH)[index] = match;
+					}
+				}
+			}
+		}
+	}
+}
+
+void MapValidator::ReadRow(unsigned int y, unsigned int * tiles) const {
+	// Neighbours nearly always come from the same layer
+	const ITileSet * owner = NULL;
+	unsigned int first = 0;
+	for (unsigned int x = 0; x < TheMap.Width; ++x) {
+		const TileSet::TileRuntime * runtime = TheMap.Cell(x, y).TileRuntimeData;
+		if (!runtime) {
+			tiles[x] = 0;
+			continue;
+		}
+		if (runtime->Owner != owner) {
+			owner = runtime->Owner;
+			first = 0;
+			for (unsigned int l = 0; l < LayerTiles.size(); ++l) {
+				if (owner == LayerTiles[l]) first = FirstTile[l];
+			}
+		}
+		tiles[x] = first ? first + runtime->Index : 0;
+	}
+}
+
+unsigned int MapValidator::Validate() {
+	unsigned int width = TheMap.Width;
+	unsigned int height = TheMap.Height;
+	unsigned int longest = width > height ? width : height;
+	HeatmapScale = (longest + HEATMAP_SIZE - 1) / HEATMAP_SIZE;
+	if (HeatmapScale == 0) HeatmapScale = 1;
+	HeatmapWidth = (width + HeatmapScale - 1) / HeatmapScale;
+	HeatmapHeight = (height + HeatmapScale - 1) / HeatmapScale;
+	Heatmap.assign((size_t)HeatmapWidth * HeatmapHeight, 0);
+
+	// Bands are whole rows of heatmap pixels, so that none of them is shared
+	unsigned int band = HeatmapScale;
+	while (band < 16) band += HeatmapScale;
+	unsigned int num_bands = (height + band - 1) / band;
+	std::vector<unsigned int> band_counts(num_bands, 0);
+	std::vector< std::vector<Conflict> > band_conflicts(num_bands);
+
+	TheMap.Pool->ParallelFor(0, num_bands, 1, [&](unsigned int b_begin, unsigned int b_end) {
+		std::vector<unsigned int> row(width);
+		std::vector<unsigned int> next_row(width);
+		for (unsigned int b = b_begin; b < b_end; ++b) {
+			if (Stopping) return;
+			unsigned int y_begin = b * band;
+			unsigned int y_end = y_begin + band < height ? y_begin + band : height;
+			unsigned int count = 0;
+			std::vector<Conflict> & conflicts = band_conflicts[b];
+
+			ReadRow(y_begin, &row[0]);
+			for (unsigned int y = y_begin; y < y_end; ++y) {
+				bool last_row = y + 1 == height;
+				if (!last_row) ReadRow(y + 1, &next_row[0]);
+				// A branchless count first: nearly every row is clean
+				const unsigned char * match_v = last_row ? NULL : &MatchV[0];
+				unsigned int found = 0;
+				for (unsigned int x = 0; x + 1 < width; ++x) {
+					found += !MatchH[row[x] * NumTiles + row[x + 1]];
+				}
+				if (match_v) {
+					for (unsigned int x = 0; x < width; ++x) {
+						found += !match_v[row[x] * NumTiles + next_row[x]];
+					}
+				}
+				if (found) {
+					count += found;
+					unsigned int * heat = &Heatmap[(size_t)(y / HeatmapScale) * HeatmapWidth];
+					for (unsigned int x = 0; x < width; ++x) {
+						bool right_ok = x + 1 == width || MatchH[row[x] * NumTiles + row[x + 1]];
+						bool down_ok = !match_v || match_v[row[x] * NumTiles + next_row[x]];
+						if (right_ok && down_ok) continue;
+
+						heat[x / HeatmapScale] += (right_ok ? 0 : 1) + (down_ok ? 0 : 1);
+						if (!right_ok) KeepLocation(conflicts, x, y, false);
+						if (!down_ok) KeepLocation(conflicts, x, y, true);
+					}
+				}
+				row.swap(next_row);
+			}
+			band_counts[b] = count;
+		}
+	});
+
+	Count = 0;
+	Conflicts.clear();
+	for (unsigned int b = 0; b < num_bands; ++b) {
+		Count += band_counts[b];
+		for (unsigned int i = 0; i < band_conflicts[b].size(); ++i) {
+			const Conflict & conflict = band_conflicts[b][i];
+			KeepLocation(Conflicts, conflict.X, conflict.Y, conflict.Vertical);
+		}
+	}
+	return Count;
+}
+
+bool MapValidator::SaveHeatmap(const char * filename) const {
+	if (Heatmap.empty()) return false;
+	unsigned int most = *std::max_element(Heatmap.begin(), Heatmap.end());
+
+	sf::Image image;
+	image.create(HeatmapWidth, HeatmapHeight, sf::Color(0, 0, 0));
+	for (unsigned int y = 0; y < HeatmapHeight; ++y) {
+		for (unsigned int x = 0; x < HeatmapWidth; ++x) {
+			unsigned int heat = Heatmap[(size_t)y * HeatmapWidth + x];
+			if (!heat) continue;
+			// From dark red for a single conflict to yellow for the most
+			unsigned int level = 255 * heat / most;
+			image.setPixel(x, y, sf::Color(128 + level / 2, level, 0));
+		}
+	}
+	return image.saveToFile(filename);
+}
+
+void MapValidator::DrawOverlay(sf::RenderTarget & target, float offset_x, float offset_y, float zoom,
+		unsigned int tile_size) const {
+	if (Conflicts.empty()) return;
+
+	// Centred on the edge between the two tiles, and never too small to be seen
+	float size = tile_size * zoom / 4;
+	if (size < 4) size = 4;
+	sf::Color color(255, 0, 255);
+	sf::VertexArray quads(sf::Quads);
+	for (unsigned int i = 0; i < Conflicts.size(); ++i) {
+		const Conflict & conflict = Conflicts[i];
+		float x = (conflict.X + (conflict.Vertical ? 0.5f : 1.0f)) * tile_size;
+		float y = (conflict.Y + (conflict.Vertical ? 1.0f : 0.5f)) * tile_size;
+		float left = (x - offset_x) * zoom - size / 2;
+		float top = (y - offset_y) * zoom - size / 2;
+		quads.append(sf::Vertex(sf::Vector2f(left, top), color));
+		quads.append(sf::Vertex(sf::Vector2f(left + size, top), color));
+		quads.append(sf::Vertex(sf::Vector2f(left + size, top + size), color));
+		quads.append(sf::Vertex(sf::Vector2f(left, top + size), color));
+	}
+	target.draw(quads);
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2013, Miriam Ruiz <miriam@debian.org> - All rights reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.
+//
+// IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VALIDATOR_H_5E8A3C10_4F3B_11E3_9C6A_525400DA3F0D
+#define VALIDATOR_H_5E8A3C10_4F3B_11E3_9C6A_525400DA3F0D
+
+#include <SFML/Graphics.hpp>
+
+#include <atomic>
+#include <vector>
+
+struct Map;
+class ITileSet;
+
+// Checks that the edges of every pair of tiles shown next to each other in a
+// finished map match. Tiles of different layers are checked the way AddTiles
+// solves them: the higher one against the empty tile of its own layer, and
+// the lower one against the solid tile of its own layer. The edges of the map
+// aren't checked against their mirror images.
+class MapValidator {
+public:
+	enum {
+		MAX_LOCATIONS = 4096, // Conflicts whose location is kept
+		HEATMAP_SIZE = 1024,  // Heatmap pixels on the longest side, at most
+	};
+
+	// Between the cell (X, Y) and the one to its right, or below it
+	struct Conflict {
+		unsigned int X;
+		unsigned int Y;
+		bool Vertical;
+	};
+
+	MapValidator(const Map & map);
+
+	// Returns the number of conflicts
+	unsigned int Validate();
+
+	// Makes Validate give up as soon as it can, with the conflicts found so far
+	inline void Stop() {
+		Stopping = true;
+	}
+
+	inline unsigned int NumConflicts() const {
+		return Count;
+	}
+
+	// The first MAX_LOCATIONS conflicts, row after row
+	inline const std::vector<Conflict> & Locations() const {
+		return Conflicts;
+	}
+
+	// Image with a pixel for each HeatmapScale x HeatmapScale cells, the
+	// redder the more conflicts there are in them
+	bool SaveHeatmap(const char * filename) const;
+
+	// Marks the conflicts on screen, for a view of the map like MapOverview::Draw
+	void DrawOverlay(sf::RenderTarget & target, float offset_x, float offset_y, float zoom,
+		unsigned int tile_size) const;
+
+private:
+	// Global indices of the tiles of a row, 0 for none
+	void ReadRow(unsigned int y, unsigned int * tiles) const;
+
+	const Map & TheMap;
+	std::vector<const ITileSet *> LayerTiles;
+	std::vector<unsigned int> FirstTile; // Global index of the first tile of each layer
+	unsigned int NumTiles;               // Global indices, counting the 0
+	std::vector<unsigned char> MatchH;   // [left * NumTiles + right]
+	std::vector<unsigned char> MatchV;   // [up * NumTiles + down]
+
+	unsigned int Count;
+	std::vector<Conflict> Conflicts;
+	unsigned int HeatmapScale;
+	unsigned int HeatmapWidth;
+	unsigned int HeatmapHeight;
+	std::vector<unsigned int> Heatmap;
+	std::atomic<bool> Stopping;
+};
+
+#endif // VALIDATOR_H_5E8A3C10_4F3B_11E3_9C6A_525400DA3F0D